@@ -0,0 +1,68 @@
+#include "def.h"
+
+#include "asset.h"
+#include "sys.h"
+
+static hashtable_t ids;             /* path to asset_id_t */
+static char **names;                /* asset_id_t to path, names[0] is NULL */
+static uint32_t n_names;
+static uint32_t names_capacity;
+
+asset_id_t asset_intern(const char *path)
+{
+    hashbucket_t *b;
+    asset_id_t *id;
+
+    if (ids.bucketsize == 0)
+        ids = hashtable_of(asset_id_t);
+
+    b = hashtable_emplace(&ids, path);
+    id = HASHBUCKET_DATAPTR(b, asset_id_t);
+
+    /* new buckets come zeroed */
+    if (*id == 0) {
+        size_t len = strlen(path) + 1;
+
+        if (n_names + 1 >= names_capacity) {
+            names_capacity = max(names_capacity * 2, 64);
+            names = sys_realloc(names, names_capacity * sizeof(char*));
+            names[0] = NULL;
+        }
+
+        *id = ++n_names;
+        names[*id] = sys_malloc(len);
+        memcpy(names[*id], path, len);
+    }
+
+    return *id;
+}
+
+/* 0 if the path was never interned */
+asset_id_t asset_find(const char *path)
+{
+    hashbucket_t *b = ids.bucketsize ? hashtable_find(&ids, path) : NULL;
+    return b ? HASHBUCKET_DATA(b, asset_id_t) : 0;
+}
+
+const char* asset_name(asset_id_t id)
+{
+    return id && id <= n_names ? names[id] : NULL;
+}
+
+/* one past the highest id, the size for arrays indexed by id */
+uint32_t asset_count()
+{
+    return n_names + 1;
+}
+
+void asset_deinit()
+{
+    for (uint32_t i = 1; i <= n_names; i++)
+        sys_free(names[i]);
+
+    sys_free(names);
+    hashtable_destroy(&ids);
+
+    names = NULL;
+    n_names = names_capacity = 0;
+}
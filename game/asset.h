@@ -0,0 +1,19 @@
+#ifndef RENG_ASSET_H
+#define RENG_ASSET_H
+
+#include <stdint.h>
+
+/*
+ * Asset paths interned to dense ids, 1 and up in order of first use, 0 is
+ * no asset. Caches keep flat arrays indexed by id, so a path is hashed once
+ * when it is interned and never again. Main thread only.
+ */
+typedef uint32_t asset_id_t;
+
+asset_id_t      asset_intern(const char *path);
+asset_id_t      asset_find(const char *path);
+const char*     asset_name(asset_id_t id);
+uint32_t        asset_count();
+void            asset_deinit();
+
+#endif
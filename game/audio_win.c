@@ -20,6 +20,13 @@ static float chunks[2][CHUNK_SIZE * N_CHANNELS];
 
 uint8_t chunk_swap = 0;
 
+/*
+ * nodes come from the pools, playing a sound doesn't hit the heap once a slab is there.
+ * The winmm callback runs on its own thread, lock covers both lists and both pools.
+ */
+static listpool_t instance_pool;
+static listpool_t delete_pool;
+static CRITICAL_SECTION lock;
 list_t instances;
 list_t delete_them;
 static char errbuf[128];
@@ -206,17 +213,20 @@ void CALLBACK wave_out_proc(HWAVEOUT wave_out_handle, UINT message, DWORD_PTR in
 			float* chunk = chunks[chunk_swap];
 			memset(chunk, 0, CHUNK_SIZE * N_CHANNELS * SAMPLE_SIZE_BYTES);
 
-			for (listnode_t *node = delete_them.begin; node != NULL; node++) {
-				list_destroy_node(&instances, LISTNODE_DATA(node, audio_instance_t*));
+			EnterCriticalSection(&lock);
+			for (listnode_t *node = delete_them.begin; node != NULL; node = node->next) {
+				list_destroy_node(&instances, LISTNODE_OF(LISTNODE_DATA(node, audio_instance_t*)));
 			}
-			delete_them = (list_t) { 0 };
+			list_destroy(&delete_them);
 
 			for (listnode_t* node = instances.begin; node != NULL;) {
 				audio_instance_t* inst = LISTNODE_DATAPTR(node, audio_instance_t);
 
 				float* samples = inst->sample->data;
-				if (!is_memory_readable(samples, 4)) /* SO FUCKING DIRTY AF */
+				if (!is_memory_readable(samples, 4)) { /* SO FUCKING DIRTY AF */
+					node = node->next;	/* spinning on it would now hold the lock forever */
 					continue;
+				}
 
 				listnode_t* next_node;
 				uint32_t written = 0;
@@ -293,8 +303,8 @@ void CALLBACK wave_out_proc(HWAVEOUT wave_out_handle, UINT message, DWORD_PTR in
 
 				node = next_node;
 			}
+			LeaveCriticalSection(&lock);
 
-			
 			if (waveOutWrite(wave_out, &header[chunk_swap], sizeof(header[chunk_swap])) != MMSYSERR_NOERROR) {
 				sys_fatal_error("waveOutWrite failed");
 			}
@@ -309,8 +319,10 @@ void CALLBACK wave_out_proc(HWAVEOUT wave_out_handle, UINT message, DWORD_PTR in
 
 audio_instance_t* audio_play_sample(audio_sample_t* sample, uint32_t start, uint32_t end, float volume, float speed, AUDIO_PLAY_TYPE play_type)
 {
-	audio_instance_t* inst = list_emplace_back(&instances, audio_instance_t);
-	
+	audio_instance_t* inst;
+
+	EnterCriticalSection(&lock);
+	inst = list_emplace_back(&instances, audio_instance_t);
 	inst->cur = start;
 	inst->sample = sample;
 	inst->start = start;
@@ -320,7 +332,8 @@ audio_instance_t* audio_play_sample(audio_sample_t* sample, uint32_t start, uint
 	inst->direction = 1;
 	inst->volume = volume;
 	inst->is_interpolated = 0;
-	
+	LeaveCriticalSection(&lock);
+
 	return inst;
 }
 
@@ -338,11 +351,19 @@ void audio_instance_interpolate(audio_instance_t* inst, uint32_t interpolate_poi
 
 void audio_stop_instance(audio_instance_t* sample)
 {
+	EnterCriticalSection(&lock);
 	*list_emplace_back(&delete_them, audio_instance_t*) = sample;
+	LeaveCriticalSection(&lock);
 }
 
 void audio_init()
 {
+	InitializeCriticalSection(&lock);
+	instance_pool = listpool_of(audio_instance_t, 32);
+	delete_pool = listpool_of(audio_instance_t*, 32);
+	instances = (list_t) { .pool = &instance_pool };
+	delete_them = (list_t) { .pool = &delete_pool };
+
 	WAVEFORMATEX format = {
 		.wFormatTag = WAVE_FORMAT_IEEE_FLOAT,
 		.nChannels = N_CHANNELS,
@@ -379,7 +400,13 @@ void audio_init()
 
 void audio_deinit()
 {
+	/* the device is never closed (see below) so the callback may still come, keep the lock alive */
+	EnterCriticalSection(&lock);
 	list_destroy(&instances);
+	list_destroy(&delete_them);
+	listpool_destroy(&instance_pool);
+	listpool_destroy(&delete_pool);
+	LeaveCriticalSection(&lock);
 
 	// TODO: proper way of closing dat shit
 	/*
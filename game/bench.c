@@ -0,0 +1,623 @@
+#include "def.h"
+
+#include "bench.h"
+#include "game.h"
+#include "gfx.h"
+#include "sys.h"
+#include "exmath.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Renders the game along a fixed camera path into an offscreen target and
+ * reports frame times and per-frame GL counters. Nothing ticks, so the same
+ * config always produces the same frames.
+ */
+
+#define BENCH_PATH_CENTER   VEC3F(4096.f, 4096.f, 0.f)
+#define BENCH_PATH_RADIUS   3072.f
+#define BENCH_TWO_PI        6.2831853f
+
+/*
+ * -bench <frames> [-bench-size <w>x<h>] [-bench-dump <frame,frame,...>] [-bench-prefix <path>] [-bench-trace <path>]
+ * -bench-math, -bench-hash and -bench-pool alone run the math kernels, the hash table and the pool only
+ */
+bool bench_parse_args(bench_config_t *cfg, int argc, char **argv)
+{
+    bool enabled = false, frames = false;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->n_frames = 1000;
+    cfg->width = 640;
+    cfg->height = 480;
+    cfg->dump_prefix = "bench_";
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "-bench") == 0) {
+            enabled = frames = true;
+            if (has_value && argv[i + 1][0] != '-') {
+                int n = atoi(argv[++i]);
+                cfg->n_frames = max(n, 1);
+            }
+        }
+        else if (strcmp(argv[i], "-bench-size") == 0 && has_value) {
+            sscanf(argv[++i], "%ux%u", &cfg->width, &cfg->height);
+        }
+        else if (strcmp(argv[i], "-bench-dump") == 0 && has_value) {
+            char *it = argv[++i];
+
+            while (*it && cfg->n_dumps < BENCH_MAX_DUMPS) {
+                cfg->dump_frames[cfg->n_dumps++] = strtoul(it, &it, 10);
+                if (*it == ',') it++;
+                else break;
+            }
+        }
+        else if (strcmp(argv[i], "-bench-prefix") == 0 && has_value) {
+            cfg->dump_prefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "-bench-trace") == 0 && has_value) {
+            cfg->trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-bench-math") == 0) {
+            enabled = cfg->math = true;
+        }
+        else if (strcmp(argv[i], "-bench-hash") == 0) {
+            enabled = cfg->hash = true;
+        }
+        else if (strcmp(argv[i], "-bench-pool") == 0) {
+            enabled = cfg->pool = true;
+        }
+    }
+
+    if (!frames)
+        cfg->n_frames = 0;
+
+    return enabled;
+}
+
+/* figure eight over the map, crosses plenty of tile chunks */
+static vec3f bench_camera(uint32_t frame, uint32_t n_frames)
+{
+    float t = BENCH_TWO_PI * frame / n_frames;
+    vec3f c = BENCH_PATH_CENTER;
+
+    return VEC3F(c.x + BENCH_PATH_RADIUS * sinf(t), c.y + BENCH_PATH_RADIUS * sinf(2.f * t), 0.f);
+}
+
+static bool bench_should_dump(const bench_config_t *cfg, uint32_t frame)
+{
+    for (uint32_t i = 0; i < cfg->n_dumps; i++)
+        if (cfg->dump_frames[i] == frame) return true;
+
+    return false;
+}
+
+/* binary ppm, rows flipped since GL reads bottom-up */
+static void bench_dump(const bench_config_t *cfg, uint32_t frame)
+{
+    char path[260];
+    size_t row = (size_t)cfg->width * 3;
+    uint8_t *pixels = sys_malloc(row * cfg->height);
+    file_handle_t f;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, cfg->width, cfg->height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+    snprintf(path, sizeof(path), "%s%u.ppm", cfg->dump_prefix, frame);
+    f = sys_try_open_file(path, "wb");
+    if (f) {
+        char header[32];
+        int len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", cfg->width, cfg->height);
+
+        sys_write_file(f, header, len);
+        for (uint32_t y = cfg->height; y-- > 0;)
+            sys_write_file(f, pixels + y * row, row);
+        sys_close_file(f);
+    }
+
+    sys_free(pixels);
+}
+
+static int bench_compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_report(const char *name, uint64_t *usec, uint32_t n)
+{
+    uint64_t sum = 0;
+
+    qsort(usec, n, sizeof(*usec), bench_compare_u64);
+    for (uint32_t i = 0; i < n; i++)
+        sum += usec[i];
+
+    printf("%-8s mean %8.3f ms  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", name,
+        sum / 1000.0 / n, usec[n / 2] / 1000.0, usec[min(n * 99 / 100, n - 1)] / 1000.0, usec[n - 1] / 1000.0);
+}
+
+#define BENCH_MATH_COUNT    4096
+#define BENCH_MATH_REPEAT   500
+#define BENCH_MATH_ANGLE    1000.f
+
+static float bench_rand()
+{
+    return (rand() % 2001) / 1000.f - 1.f;
+}
+
+static double bench_usec_since(uint64_t start)
+{
+    return (double)(sys_get_time_usec() - start);
+}
+
+/* against libm in double */
+static float bench_trig_error(const float *s, const float *c, const float *ang, size_t n)
+{
+    double err = 0.0;
+
+    for (size_t i = 0; i < n; i++) {
+        err = fmax(err, fabs(s[i] - sin(ang[i])));
+        err = fmax(err, fabs(c[i] - cos(ang[i])));
+    }
+    return (float)err;
+}
+
+/*
+ * Every exmath kernel on every instruction set the CPU has, as ns per
+ * element, with the largest difference from the scalar results. Sin and
+ * cos are checked against libm instead, over angles up to BENCH_MATH_ANGLE.
+ */
+void bench_math()
+{
+    size_t n = BENCH_MATH_COUNT;
+    mat4 *ma = sys_malloc(n * sizeof(mat4)), *mb = sys_malloc(n * sizeof(mat4));
+    mat4 *mres = sys_malloc(n * sizeof(mat4)), *mref = sys_malloc(n * sizeof(mat4));
+    vec3f *p3 = sys_malloc(n * sizeof(vec3f)), *o3 = sys_malloc(n * sizeof(vec3f)), *r3 = sys_malloc(n * sizeof(vec3f));
+    vec2f *p2 = sys_malloc(n * sizeof(vec2f)), *o2 = sys_malloc(n * sizeof(vec2f)), *r2 = sys_malloc(n * sizeof(vec2f));
+    affine2d *ay = sys_malloc(n * sizeof(affine2d)), *ao = sys_malloc(n * sizeof(affine2d)), *ar = sys_malloc(n * sizeof(affine2d));
+    float *ang = sys_malloc(n * sizeof(float)), *so = sys_malloc(n * sizeof(float)), *co = sys_malloc(n * sizeof(float));
+    affine2d ax;
+    mat4 persp;
+    uint64_t start;
+
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < 16; k++) {
+            ma[i].v[k] = bench_rand();
+            mb[i].v[k] = bench_rand();
+        }
+        for (int k = 0; k < 6; k++)
+            ay[i].v[k] = bench_rand();
+
+        p3[i] = VEC3F(bench_rand(), bench_rand(), bench_rand() - 4.f);
+        p2[i] = VEC2F(bench_rand() * 100.f, bench_rand() * 100.f);
+        ang[i] = bench_rand() * BENCH_MATH_ANGLE + bench_rand();
+    }
+
+    affine2d_rotation(&ax, 0.7f);
+    affine2d_translate(&ax, VEC2F(10.f, -3.f));
+    mat4_perspective(&persp, 1.f, 4.f, 3.f, 0.1f, 100.f);
+
+    start = sys_get_time_usec();
+    for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+        for (size_t i = 0; i < n; i++) {
+            so[i] = sinf(ang[i]);
+            co[i] = cosf(ang[i]);
+        }
+    printf("%-18s %7.2f ns   error %g\n", "sinf + cosf", bench_usec_since(start) * 1000.0 / ((double)n * BENCH_MATH_REPEAT),
+        bench_trig_error(so, co, ang, n));
+
+    start = sys_get_time_usec();
+    for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+        for (size_t i = 0; i < n; i++)
+            exmath_sincosf_poly(ang[i], &so[i], &co[i]);
+    printf("%-18s %7.2f ns   error %g\n\n", "sincosf_poly", bench_usec_since(start) * 1000.0 / ((double)n * BENCH_MATH_REPEAT),
+        bench_trig_error(so, co, ang, n));
+
+    printf("%-18s %10s %10s %10s %10s %10s\n", "", "mat4_mul", "apply_mat4", "apply_aff", "aff_mul", "sincos_n");
+
+    for (int level = 0; level <= exmath_simd_available(); level++) {
+        double t[5];
+        float err = 0.f;
+
+        exmath_set_simd_level(level);
+
+        start = sys_get_time_usec();
+        for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+            for (size_t i = 0; i < n; i++)
+                mat4_mul(&mres[i], &ma[i], &mb[i]);
+        t[0] = bench_usec_since(start);
+
+        start = sys_get_time_usec();
+        for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+            vec3f_apply_mat4_n(o3, p3, n, &persp);
+        t[1] = bench_usec_since(start);
+
+        start = sys_get_time_usec();
+        for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+            vec2f_apply_affine2d_n(o2, p2, n, &ax);
+        t[2] = bench_usec_since(start);
+
+        start = sys_get_time_usec();
+        for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+            affine2d_mul_n(ao, &ax, ay, n);
+        t[3] = bench_usec_since(start);
+
+        start = sys_get_time_usec();
+        for (int r = 0; r < BENCH_MATH_REPEAT; r++)
+            exmath_sincosf_n(so, co, ang, n);
+        t[4] = bench_usec_since(start);
+
+        /* scalar runs first and is the reference */
+        if (level == EXMATH_SIMD_SCALAR) {
+            memcpy(mref, mres, n * sizeof(mat4));
+            memcpy(r3, o3, n * sizeof(vec3f));
+            memcpy(r2, o2, n * sizeof(vec2f));
+            memcpy(ar, ao, n * sizeof(affine2d));
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            for (int k = 0; k < 16; k++) err = fmaxf(err, fabsf(mres[i].v[k] - mref[i].v[k]));
+            for (int k = 0; k < 3; k++) err = fmaxf(err, fabsf(o3[i].v[k] - r3[i].v[k]));
+            for (int k = 0; k < 2; k++) err = fmaxf(err, fabsf(o2[i].v[k] - r2[i].v[k]) / 100.f);
+            for (int k = 0; k < 6; k++) err = fmaxf(err, fabsf(ao[i].v[k] - ar[i].v[k]));
+        }
+
+        printf("%-18s", exmath_simd_name(level));
+        for (int k = 0; k < 5; k++)
+            printf(" %7.2f ns", t[k] * 1000.0 / ((double)n * BENCH_MATH_REPEAT));
+        printf("   max error %g, sincos error %g\n", err, bench_trig_error(so, co, ang, n));
+    }
+
+    exmath_set_simd_level(EXMATH_SIMD_COUNT);
+
+    sys_free(ma); sys_free(mb); sys_free(mres); sys_free(mref);
+    sys_free(p3); sys_free(o3); sys_free(r3);
+    sys_free(p2); sys_free(o2); sys_free(r2);
+    sys_free(ay); sys_free(ao); sys_free(ar);
+    sys_free(ang); sys_free(so); sys_free(co);
+}
+
+#define BENCH_HASH_LOOKUPS  (1 << 20)
+#define BENCH_HASH_NAME     48
+
+/*
+ * Asset paths are added, looked up far more often than added, and some
+ * lookups miss. Churn erases and re-adds names, which nothing in the tree
+ * does since asset ids are never dropped, but it covers tombstones.
+ * Reported as ns per operation for a few table sizes, small tables are
+ * filled many times over so emplace is timed over enough adds.
+ */
+void bench_hash()
+{
+    static const uint32_t sizes[] = { 64, 1024, 16384 };
+
+    printf("%-8s %10s %10s %10s %10s\n", "names", "emplace", "find", "miss", "churn");
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t n = sizes[s];
+        char (*hits)[BENCH_HASH_NAME] = sys_malloc(n * BENCH_HASH_NAME);
+        char (*misses)[BENCH_HASH_NAME] = sys_malloc(n * BENCH_HASH_NAME);
+        hashtable_t table = hashtable_of(uint32_t);
+        uint32_t rounds = max(BENCH_HASH_LOOKUPS / 16 / n, 1);
+        double t[4];
+        uint32_t found = 0;
+        uint64_t start;
+
+        for (uint32_t i = 0; i < n; i++) {
+            snprintf(hits[i], BENCH_HASH_NAME, "textures/tiles/tile_%u.png", i);
+            snprintf(misses[i], BENCH_HASH_NAME, "textures/cars/car_%u.png", i);
+        }
+
+        t[0] = 0.0;
+        for (uint32_t r = 0; r < rounds; r++) {
+            if (r > 0) hashtable_destroy(&table);
+
+            start = sys_get_time_usec();
+            for (uint32_t i = 0; i < n; i++)
+                HASHBUCKET_DATA(hashtable_emplace(&table, hits[i]), uint32_t) = i;
+            t[0] += bench_usec_since(start);
+        }
+        t[0] = t[0] * 1000.0 / ((double)n * rounds);
+
+        start = sys_get_time_usec();
+        for (uint32_t i = 0; i < BENCH_HASH_LOOKUPS; i++)
+            found += hashtable_find(&table, hits[(i * 2654435761u) % n]) != NULL;
+        t[1] = bench_usec_since(start) * 1000.0 / BENCH_HASH_LOOKUPS;
+
+        start = sys_get_time_usec();
+        for (uint32_t i = 0; i < BENCH_HASH_LOOKUPS; i++)
+            found += hashtable_find(&table, misses[i % n]) == NULL;
+        t[2] = bench_usec_since(start) * 1000.0 / BENCH_HASH_LOOKUPS;
+
+        /* evict one, bring it back, the table size stays put */
+        start = sys_get_time_usec();
+        for (uint32_t i = 0; i < BENCH_HASH_LOOKUPS; i++) {
+            hashtable_erase(&table, hashtable_find(&table, hits[i % n]));
+            HASHBUCKET_DATA(hashtable_emplace(&table, hits[i % n]), uint32_t) = i;
+        }
+        t[3] = bench_usec_since(start) * 1000.0 / BENCH_HASH_LOOKUPS;
+
+        printf("%-8u", n);
+        for (int k = 0; k < 4; k++)
+            printf(" %7.1f ns", t[k]);
+        printf("   %zu buckets%s\n", table.n_buckets, found == 2 * BENCH_HASH_LOOKUPS ? "" : ", LOOKUPS FAILED");
+
+        hashtable_destroy(&table);
+        sys_free(hits);
+        sys_free(misses);
+    }
+}
+
+#define BENCH_POOL_THREADS  4
+#define BENCH_POOL_OPS      (1 << 20)   /* allocations per thread */
+#define BENCH_POOL_LIVE     256         /* objects a thread holds at once */
+
+/* objects handed to a thread for it to free, so frees cross threads */
+typedef struct bench_pool_mailbox {
+    sys_mutex_t *lock;
+    uint8_t *objects[BENCH_POOL_LIVE];
+    uint32_t count;
+    uint32_t errors;            /* of the owning thread, read after the join */
+} bench_pool_mailbox_t;
+
+static bench_pool_mailbox_t bench_mailboxes[BENCH_POOL_THREADS];
+
+/* mostly small classes, every 64th one takes the large path */
+static uint32_t bench_pool_size(uint32_t r)
+{
+    return (r & 63) == 0 ? SYS_POOL_MAX_SIZE + 1 + (r >> 6) % 8192 : 16 + (r >> 6) % (SYS_POOL_MAX_SIZE - 15);
+}
+
+/* the size sits in front, the rest is filled with a byte derived from it */
+static uint8_t* bench_pool_alloc(uint32_t size)
+{
+    uint8_t *obj = sys_pool_alloc(size);
+
+    memset(obj + sizeof(uint32_t), (uint8_t)(size * 31), size - sizeof(uint32_t));
+    memcpy(obj, &size, sizeof(uint32_t));
+    return obj;
+}
+
+/* returns 1 if someone else wrote into the object */
+static uint32_t bench_pool_free(uint8_t *obj)
+{
+    uint32_t size;
+    uint8_t fill;
+    bool bad;
+
+    memcpy(&size, obj, sizeof(uint32_t));
+    fill = (uint8_t)(size * 31);
+    bad = obj[sizeof(uint32_t) + 4] != fill || obj[size - 1] != fill;
+
+    sys_pool_free(obj);
+    return bad;
+}
+
+static uint32_t bench_pool_drain(bench_pool_mailbox_t *box)
+{
+    uint32_t errors = 0;
+
+    sys_lock_mutex(box->lock);
+    for (uint32_t i = 0; i < box->count; i++)
+        errors += bench_pool_free(box->objects[i]);
+    box->count = 0;
+    sys_unlock_mutex(box->lock);
+
+    return errors;
+}
+
+/* about half the objects it replaces go to the next thread's mailbox */
+static int bench_pool_thread(void *arg)
+{
+    uint32_t index = (uint32_t)(uintptr_t)arg;
+    bench_pool_mailbox_t *next = &bench_mailboxes[(index + 1) % BENCH_POOL_THREADS];
+    uint8_t *live[BENCH_POOL_LIVE] = { 0 };
+    uint32_t rng = 0x9E3779B9u * (index + 1), errors = 0;
+
+    for (uint32_t i = 0; i < BENCH_POOL_OPS; i++) {
+        uint32_t slot = i % BENCH_POOL_LIVE;
+        bool handed = false;
+
+        rng = rng * 1664525u + 1013904223u;
+
+        if (live[slot] && (rng & 0x80000000u)) {
+            sys_lock_mutex(next->lock);
+            if (next->count < BENCH_POOL_LIVE) {
+                next->objects[next->count++] = live[slot];
+                handed = true;
+            }
+            sys_unlock_mutex(next->lock);
+        }
+
+        if (live[slot] && !handed)
+            errors += bench_pool_free(live[slot]);
+
+        live[slot] = bench_pool_alloc(bench_pool_size(rng >> 8));
+
+        if (slot == 0)
+            errors += bench_pool_drain(&bench_mailboxes[index]);
+    }
+
+    for (uint32_t i = 0; i < BENCH_POOL_LIVE; i++)
+        errors += bench_pool_free(live[i]);
+
+    bench_mailboxes[index].errors = errors + bench_pool_drain(&bench_mailboxes[index]);
+    return 0;
+}
+
+/*
+ * Several threads allocate and free at once, handing some objects to each
+ * other. The objects are checked for overlap when freed, and once the
+ * threads are gone every class must have seen as many frees as allocations.
+ */
+void bench_pool()
+{
+    sys_thread_t *threads[BENCH_POOL_THREADS];
+    sys_pool_stats_t before[SYS_POOL_N_CLASSES + 1], after[SYS_POOL_N_CLASSES + 1];
+    uint32_t errors = 0, unbalanced = 0;
+    uint64_t start;
+
+    sys_pool_get_stats(before);
+
+    for (uint32_t i = 0; i < BENCH_POOL_THREADS; i++)
+        bench_mailboxes[i] = (bench_pool_mailbox_t) { .lock = sys_create_mutex() };
+
+    start = sys_get_time_usec();
+    for (uint32_t i = 0; i < BENCH_POOL_THREADS; i++)
+        threads[i] = sys_create_thread(bench_pool_thread, (void*)(uintptr_t)i);
+
+    for (uint32_t i = 0; i < BENCH_POOL_THREADS; i++)
+        sys_join_thread(threads[i]);
+    double usec = bench_usec_since(start);
+
+    /* a thread may have handed objects on after their owner finished */
+    for (uint32_t i = 0; i < BENCH_POOL_THREADS; i++) {
+        errors += bench_mailboxes[i].errors + bench_pool_drain(&bench_mailboxes[i]);
+        sys_destroy_mutex(bench_mailboxes[i].lock);
+    }
+
+    sys_pool_get_stats(after);
+
+    printf("%-8s %8s %10s %10s\n", "class", "slabs", "allocs", "frees");
+    for (uint32_t c = 0; c <= SYS_POOL_N_CLASSES; c++) {
+        uint64_t allocs = after[c].n_allocs - before[c].n_allocs;
+        uint64_t frees = after[c].n_frees - before[c].n_frees;
+
+        if (allocs != frees)
+            unbalanced++;
+
+        if (c == SYS_POOL_N_CLASSES) printf("%-8s", "large");
+        else printf("%-8u", after[c].size);
+        printf(" %8u %10llu %10llu\n", after[c].n_slabs, (unsigned long long)allocs, (unsigned long long)frees);
+    }
+
+    printf("%u threads: %.1f ns per alloc and free, %u corrupted, %u classes unbalanced\n",
+        BENCH_POOL_THREADS, usec * 1000.0 / ((double)BENCH_POOL_THREADS * BENCH_POOL_OPS), errors, unbalanced);
+}
+
+void bench_run(const bench_config_t *cfg)
+{
+    GLuint fbo, color, depth;
+    uint64_t *cpu_usec, *frame_usec;
+    uint64_t draw_calls = 0, state_changes = 0, vertices = 0;
+    double pass_cpu_ms[GFX_LAYER_COUNT] = { 0 }, pass_gpu_ms[GFX_LAYER_COUNT] = { 0 };
+    uint32_t n_resolved = 0;
+#ifdef RENG_MEMTRACE
+    uint64_t heap_calls = 0;
+    uint32_t heap_frames = 0, last_heap_frame = 0;
+#endif
+
+    if (cfg->math)
+        bench_math();
+    if (cfg->hash)
+        bench_hash();
+    if (cfg->pool)
+        bench_pool();
+    if (cfg->n_frames == 0)
+        return;
+
+    cpu_usec = sys_malloc(cfg->n_frames * sizeof(uint64_t));
+    frame_usec = sys_malloc(cfg->n_frames * sizeof(uint64_t));
+
+    glwrapGenTextures(1, &color);
+    gfx_state_bind_texture(0, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cfg->width, cfg->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glwrapGenTextures(1, &depth);
+    gfx_state_bind_texture(0, depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, cfg->width, cfg->height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+
+    glGenFramebuffers(1, &fbo);
+    gfx_state_bind_framebuffer(fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        sys_fatal_error("Benchmark framebuffer is incomplete");
+
+    sys.width = cfg->width;
+    sys.height = cfg->height;
+    sys.interpolation = 0.f;
+
+    /* streamed textures would make the first frames differ between runs */
+    while (gfx_stream_pending())
+        gfx_stream_update(GFX_STREAM_BUDGET_USEC);
+
+    for (uint32_t i = 0; i < cfg->n_frames; i++) {
+        vec3f cam = bench_camera(i, cfg->n_frames);
+        uint64_t start = sys_get_time_usec();
+#ifdef RENG_MEMTRACE
+        uint64_t heap_start = sys_memtrace_heap_calls();
+#endif
+
+        game_set_camera(&cam);
+        gfx_state_set_viewport(0, 0, cfg->width, cfg->height);
+        sys_arena_reset(&sys_frame_arena);
+        gfx_begin_frame();
+        game_draw();
+        gfx_end_frame();
+        cpu_usec[i] = sys_get_time_usec() - start;
+
+#ifdef RENG_MEMTRACE
+        /* buffers grow to the busiest frame so far, after that frames shouldn't touch the heap */
+        if (sys_memtrace_heap_calls() != heap_start) {
+            heap_calls += sys_memtrace_heap_calls() - heap_start;
+            heap_frames++;
+            last_heap_frame = i;
+        }
+#endif
+
+        glFinish();
+        frame_usec[i] = sys_get_time_usec() - start;
+
+        draw_calls += gfx.state.frame.draw_calls;
+        state_changes += gfx.state.frame.issued;
+        vertices += gfx.state.frame.vertices;
+
+        /* published by gfx_begin_frame, GFX_PROF_LATENCY frames behind */
+        if (i >= GFX_PROF_LATENCY) {
+            for (uint32_t p = 0; p < GFX_LAYER_COUNT; p++) {
+                pass_cpu_ms[p] += gfx.prof.cpu_ms[p];
+                pass_gpu_ms[p] += gfx.prof.gpu_ms[p];
+            }
+            n_resolved++;
+        }
+
+        if (bench_should_dump(cfg, i))
+            bench_dump(cfg, i);
+    }
+
+    printf("benchmark: %u frames at %ux%u\n", cfg->n_frames, cfg->width, cfg->height);
+    bench_report("cpu", cpu_usec, cfg->n_frames);
+    bench_report("frame", frame_usec, cfg->n_frames);
+    printf("per frame: %.1f draw calls, %.1f state changes, %.1f vertices\n",
+        (double)draw_calls / cfg->n_frames, (double)state_changes / cfg->n_frames, (double)vertices / cfg->n_frames);
+#ifdef RENG_MEMTRACE
+    if (heap_frames)
+        printf("heap: %llu allocations in %u frames, the last in frame %u\n", heap_calls, heap_frames, last_heap_frame);
+    else
+        printf("heap: no allocations\n");
+#endif
+
+    for (uint32_t p = 0; p < GFX_LAYER_COUNT && n_resolved; p++) {
+        printf("%-8s cpu %8.3f ms  gpu %8.3f ms\n", gfx_layer_name(p),
+            pass_cpu_ms[p] / n_resolved, pass_gpu_ms[p] / n_resolved);
+    }
+
+    if (cfg->trace_path && !gfx_prof_write_trace(cfg->trace_path))
+        printf("failed to write %s\n", cfg->trace_path);
+
+    game_set_camera(NULL);
+    gfx_state_bind_framebuffer(0);
+    glDeleteFramebuffers(1, &fbo);
+    gfx_state_forget_texture(color);
+    gfx_state_forget_texture(depth);
+    glwrapDeleteTextures(1, &color);
+    glwrapDeleteTextures(1, &depth);
+
+    sys_free(cpu_usec);
+    sys_free(frame_usec);
+}
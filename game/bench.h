@@ -0,0 +1,30 @@
+#ifndef DOC_BENCH_H
+#define DOC_BENCH_H
+
+#include "def.h"
+
+#define BENCH_MAX_DUMPS 16
+
+/* offscreen benchmark over a scripted camera path, see bench.c */
+typedef struct bench_config {
+    uint32_t n_frames;
+    uint32_t width, height;
+
+    /* frames written to "<dump_prefix><frame>.ppm" for golden image comparison */
+    uint32_t dump_frames[BENCH_MAX_DUMPS];
+    uint32_t n_dumps;
+    const char *dump_prefix;
+
+    const char *trace_path;     /* profiler trace of the last frames, NULL for none */
+    bool math;                  /* exmath kernels on every instruction set first, see bench_math */
+    bool hash;                  /* hashtable_t under asset table traffic, see bench_hash */
+    bool pool;                  /* sys_pool_alloc from several threads, see bench_pool */
+} bench_config_t;
+
+bool bench_parse_args(bench_config_t *cfg, int argc, char **argv);
+void bench_run(const bench_config_t *cfg);
+void bench_math();
+void bench_hash();
+void bench_pool();
+
+#endif
@@ -11,6 +11,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <math.h>
 
 #define TICKS_PER_SECOND (int)25
@@ -23,6 +24,8 @@
 #ifdef _WIN32
 #define KEY_SPACE VK_SPACE
 #define KEY_ESCAPE VK_ESCAPE
+#define KEY_F3 VK_F3
+#define KEY_F4 VK_F4
 #else
 #error Unsupported OS
 #endif
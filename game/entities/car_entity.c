@@ -2,6 +2,7 @@
 #include "../gfx.h"
 
 struct car_noises_struct car_noises;
+struct car_effects_struct car_effects;
 
 void car_entity_init(car_entity_t* ent)
 {
@@ -12,11 +13,57 @@ void car_entity_init(car_entity_t* ent)
     ent->engine_force = 0.f;
     ent->pre_wheels_speed = 0.f;
     ent->grip = 1.f;
+    ent->skidding = false;
     ent->engine_sound = NULL;
 }
 
 #define ENGINE_SOUND_LOOP_LEN (AUDIO_SAMPLE_RATE / 8)
 
+/* rear wheels in car space, see the sprite transform in car_entity_draw */
+#define CAR_REAR_AXLE   8.f
+#define CAR_HALF_TRACK  28.f
+#define CAR_TIRE_WIDTH  10.f
+
+static float randf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() % 1001) / 1000.f;
+}
+
+/* skid marks and smoke grow with slip, debris only comes off in hard slides */
+static void car_entity_emit(car_entity_t* ent, vec3f car_dir)
+{
+    float slip = 1.f - ent->grip;
+    bool skidding = slip >= 0.2f;
+    vec2f side = VEC2F(-car_dir.y, car_dir.x);
+
+    for (int wheel = 0; wheel < 2; wheel++) {
+        float track = wheel ? CAR_HALF_TRACK : -CAR_HALF_TRACK;
+        vec2f pos = VEC2F(
+            ent->pos.x + car_dir.x * CAR_REAR_AXLE + side.x * track,
+            ent->pos.y + car_dir.y * CAR_REAR_AXLE + side.y * track);
+        vec2f drift = VEC2F(ent->velocity.x * 0.3f, ent->velocity.y * 0.3f);
+
+        if (skidding && ent->skidding)
+            gfx_decal_stamp(&car_effects.skids, ent->wheel_pos[wheel], pos, CAR_TIRE_WIDTH, fminf(slip * 1.5f, 1.f));
+        ent->wheel_pos[wheel] = pos;
+
+        if (!skidding)
+            continue;
+
+        for (int i = (int)(slip * 6.f); i > 0; i--) {
+            vec2f vel = vec2f_sum(drift, VEC2F(randf(-1.f, 1.f), randf(-1.f, 1.f)));
+            gfx_emitter_spawn(&car_effects.smoke, pos, vel, randf(12.f, 20.f), randf(1.f, 2.f), 20 + rand() % 30);
+        }
+
+        if (slip > 0.5f && rand() % 3 == 0) {
+            vec2f vel = vec2f_sum(drift, VEC2F(randf(-4.f, 4.f), randf(-4.f, 4.f)));
+            gfx_emitter_spawn(&car_effects.debris, pos, vel, randf(2.f, 4.f), -0.1f, 10 + rand() % 10);
+        }
+    }
+
+    ent->skidding = skidding;
+}
+
 float rpm_curve(float rpm)
 {
     return 0.1f + fminf(rpm / 40.f, 1.f);
@@ -24,7 +71,8 @@ float rpm_curve(float rpm)
 
 void car_entity_tick(car_entity_t* ent)
 {
-    vec3f car_dir = VEC3F(cosf(ent->rotation.z), sinf(ent->rotation.z), 0.f);
+    vec3f car_dir = VEC3F(0.f, 0.f, 0.f);
+    exmath_sincosf(ent->rotation.z, &car_dir.y, &car_dir.x);
     
     float speed = vec3f_len(ent->velocity);
     if (vec3f_dot(car_dir, vec3f_normalized(ent->velocity)) < 0) speed = -speed;
@@ -83,12 +131,13 @@ void car_entity_tick(car_entity_t* ent)
 
     ent->engine_sound->speed = ent->engine_force / 12.f + 0.7f;
     ent->extra_sound->volume = fmaxf(0.f, (1.f - ent->grip) * 0.3f - 0.1f);
+
+    car_entity_emit(ent, car_dir);
 }
 
 void car_entity_draw(car_entity_t* ent)
 {
-    mat4 ident = MAT4_IDENTITY;
-    mat4 modelmat = MAT4_IDENTITY;
+    affine2d modelmat;
 
     vec3f future_pos = vec3f_sum(ent->pos, ent->velocity);
     vec3f future_rotation = vec3f_sum(ent->rotation, ent->rotation_velocity);
@@ -98,27 +147,23 @@ void car_entity_draw(car_entity_t* ent)
     vec3f visual_pos = vec3f_sum(vec3f_prod(ent->pos, k1), vec3f_prod(future_pos, k2));
     vec3f visual_rotation = vec3f_sum(vec3f_prod(ent->rotation, k1), vec3f_prod(future_rotation, k2));
 
-    vec3f car_dir = VEC3F(cosf(ent->rotation.z), sinf(ent->rotation.z), 0.f);
+    vec3f car_dir = VEC3F(0.f, 0.f, 0.f);
+    exmath_sincosf(ent->rotation.z, &car_dir.y, &car_dir.x);
     float offset = ((rand() % 1000) / 500.f - 1.f) * ent->engine_force / ent->cardata->engine_force_max;
     vec3f_add(&visual_pos, VEC3F(car_dir.y * offset, car_dir.x * offset, 0.f));
 
-    mat4_translate(&modelmat, visual_pos);
-    mat4_rotate_z(&modelmat, visual_rotation.z);
-    mat4_translate(&modelmat, VEC3F(-18, -38, 0));
-    mat4_scale(&modelmat, VEC3F(124, 78, 1));
-
-    glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, modelmat.v);
-    glUniformMatrix4fv(shader.textransform_mat_location, 1, GL_TRUE, ident.v);
+    affine2d_translation(&modelmat, VEC2F(visual_pos.x, visual_pos.y));
+    affine2d_rotate(&modelmat, visual_rotation.z);
+    affine2d_translate(&modelmat, VEC2F(-18, -38));
+    affine2d_scale(&modelmat, VEC2F(124, 78));
 
-    glBindTexture(GL_TEXTURE_2D, ent->cardata->tx);
-    glBindVertexArray(shader.quad_vao);
-    glDrawArrays(GL_QUADS, 0, 4);
+    gfx_draw_sprite(ent->cardata->tx, &modelmat, GFX_FULL_TEXRECT);
 }
 
 void car_entity_deinit(car_entity_t* ent)
 {
-    audio_stop_instance(&ent->engine_sound);
-    audio_stop_instance(&ent->extra_sound);
+    audio_stop_instance(ent->engine_sound);
+    audio_stop_instance(ent->extra_sound);
 }
 
 void car_entity_set_model(car_entity_t* ent, car_model_t* car_model)
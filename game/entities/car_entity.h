@@ -4,6 +4,7 @@
 #include "../def.h"
 #include "../entity.h"
 #include "../audio.h"
+#include "../gfx.h"
 
 typedef struct car_model {
     uint32_t tx;
@@ -24,6 +25,10 @@ typedef struct car_entity {
     float grip;
     int gear;
 
+    /* rear wheels at the last tick, skid marks are stamped from there */
+    vec2f wheel_pos[2];
+    bool skidding;
+
     audio_instance_t* engine_sound;
     audio_instance_t* extra_sound;
     float old_throttle;
@@ -33,6 +38,13 @@ extern struct car_noises_struct {
     audio_sample_t tire_screech;
 } car_noises;
 
+/* shared by every car, updated in game_tick */
+extern struct car_effects_struct {
+    gfx_emitter_t smoke;
+    gfx_emitter_t debris;
+    gfx_decal_layer_t skids;
+} car_effects;
+
 void car_entity_set_model(car_entity_t* ent, car_model_t* car_model);
 
 #endif
\ No newline at end of file
@@ -13,8 +13,7 @@ void ped_entity_tick(ped_entity_t* ent)
 
 void ped_entity_draw(ped_entity_t* ent)
 {
-    mat4 ident = MAT4_IDENTITY;
-    mat4 modelmat = MAT4_IDENTITY;
+    affine2d modelmat;
 
     vec3f future_pos = vec3f_sum(ent->pos, ent->velocity);
     vec3f future_rotation = vec3f_sum(ent->rotation, ent->rotation_velocity);
@@ -24,17 +23,12 @@ void ped_entity_draw(ped_entity_t* ent)
     vec3f visual_pos = vec3f_sum(vec3f_prod(ent->pos, k1), vec3f_prod(future_pos, k2));
     vec3f visual_rotation = vec3f_sum(vec3f_prod(ent->rotation, k1), vec3f_prod(future_rotation, k2));
 
-    mat4_translate(&modelmat, visual_pos);
-    mat4_rotate_z(&modelmat, visual_rotation.z);
-    mat4_translate(&modelmat, VEC3F(-12, -30, 0));
-    mat4_scale(&modelmat, VEC3F(24, 60, 1));
+    affine2d_translation(&modelmat, VEC2F(visual_pos.x, visual_pos.y));
+    affine2d_rotate(&modelmat, visual_rotation.z);
+    affine2d_translate(&modelmat, VEC2F(-12, -30));
+    affine2d_scale(&modelmat, VEC2F(24, 60));
 
-    glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, modelmat.v);
-    glUniformMatrix4fv(shader.textransform_mat_location, 1, GL_TRUE, ident.v);
-
-    glBindTexture(GL_TEXTURE_2D, ent->pedtype->texture);
-    glBindVertexArray(shader.quad_vao);
-    glDrawArrays(GL_QUADS, 0, 4);
+    gfx_draw_sprite(ent->pedtype->texture, &modelmat, GFX_FULL_TEXRECT);
 }
 
 void ped_entity_deinit(ped_entity_t* ent)
@@ -9,7 +9,7 @@ FINALIZE_ENTITY_TYPE(base_entity, entity_empty_func, entity_empty_func, entity_e
 list_t entlist;
 
 base_entity_t* entity_create(entity_vtable_t* type) {
-    base_entity_t* ent = sys_malloc(type->sz);
+    base_entity_t* ent = sys_pool_alloc(type->sz);
     memset(ent, 0, type->sz);
     ent->type = type;
     ent->type->init(ent);
@@ -27,5 +27,5 @@ void entity_tick(base_entity_t *ent)
 void entity_destroy(base_entity_t* ent)
 {
     ent->type->deinit(ent);
-    sys_free(ent);
+    sys_pool_free(ent);
 }
\ No newline at end of file
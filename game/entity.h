@@ -36,12 +36,13 @@ typedef struct base_entity {
                                                 \
         int64_t last_tick;                      \
         vec3f velocity;                         \
-        vec3f rotation, rotation_velocity
+        vec3f rotation, rotation_velocity;      \
+        listnode_t node                         /* in entlist */
 
     EXTEND_BASE_ENTITY;
 } base_entity_t;
 
-extern list_t entlist;
+extern list_t entlist;                                                      /* intrusive, through base_entity_t.node */
 
 static inline void  entity_draw(base_entity_t* ent) { ent->type->draw(ent); }
 void                entity_tick(base_entity_t* ent);
@@ -1,15 +1,6 @@
 #include "exmath.h"
 #include <math.h>
 
-mat4 *mat4_mul(mat4 *res, mat4 *a, mat4 *b)
-{
-	for (int j = 0; j < 4; j++)
-		for (int i = 0; i < 4; i++)
-			res->v[j*4 + i] = a->v[j*4]*b->v[i] + a->v[j*4+1]*b->v[i+4] + a->v[j*4+2]*b->v[i+8] + a->v[j*4+3]*b->v[i+12];
-		
-	return res;
-}
-
 mat4 *mat4_perspective(mat4 *res, float fov, float W, float H, float N, float F) {
     float f  = 1.0f / tanf(fov);
 	
@@ -24,8 +15,8 @@ mat4 *mat4_perspective(mat4 *res, float fov, float W, float H, float N, float F)
 }
 
 mat4 *mat4_rotation_x(mat4 *res, float ang) {
-	float c = cosf(ang);
-	float s = sinf(ang);
+	float c, s;
+	exmath_sincosf(ang, &s, &c);
 
 	*res = (mat4) { 0 };
 	res->v[0] = 1.f; res->v[5] = c;
@@ -36,8 +27,8 @@ mat4 *mat4_rotation_x(mat4 *res, float ang) {
 }
 
 mat4 *mat4_rotation_y(mat4 *res, float ang) {
-	float c = cosf(ang);
-	float s = sinf(ang);
+	float c, s;
+	exmath_sincosf(ang, &s, &c);
 
 	*res = (mat4) { 0 };
 	res->v[5] = 1;  res->v[15] = 1;
@@ -48,8 +39,8 @@ mat4 *mat4_rotation_y(mat4 *res, float ang) {
 }
 
 mat4 *mat4_rotation_z(mat4 *res, float ang) {
-	float c = cosf(ang);
-	float s = sinf(ang);
+	float c, s;
+	exmath_sincosf(ang, &s, &c);
 
 	*res = (mat4) { 0 };
 	res->v[10] = 1; res->v[15] = 1;
@@ -107,4 +98,14 @@ mat4 *mat4_ortho_projection(mat4 *res, float left, float right, float top, float
 	res->v[15] = 1.f;
 
 	return res;
-}
\ No newline at end of file
+}
+
+mat4 *mat4_from_affine2d(mat4 *res, const affine2d *m)
+{
+	*res = (mat4) { 0 };
+	res->v[0] = m->a; res->v[1] = m->b; res->v[3] = m->tx;
+	res->v[4] = m->c; res->v[5] = m->d; res->v[7] = m->ty;
+	res->v[10] = res->v[15] = 1.f;
+
+	return res;
+}
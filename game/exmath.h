@@ -2,6 +2,42 @@
 #define RENG_MATH_H
 
 #include <math.h>
+#include <stddef.h>
+
+/* exmath_sincosf uses the polynomial below instead of libm */
+/* #define EXMATH_FAST_TRIG */
+
+/*
+ * sin and cos at once: the angle is reduced to [-pi/4, pi/4] around the
+ * nearest multiple of pi/2 and both go through minimax polynomials. Error
+ * stays under 1e-6 for |ang| < 1e5, past that the reduction loses bits.
+ */
+static inline void exmath_sincosf_poly(float ang, float *s, float *c)
+{
+    float x = ang * 0.63661977f;
+    int q = (int)(x + (x >= 0.f ? 0.5f : -0.5f));
+    float r = ang - q * 1.5703125f - q * 4.837512969970703125e-4f - q * 7.54978995489188216e-8f;
+    float r2 = r * r;
+    float ps = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    float pc = 1.f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+
+    switch (q & 3) {
+        case 0: *s = ps;  *c = pc;  break;
+        case 1: *s = pc;  *c = -ps; break;
+        case 2: *s = -ps; *c = -pc; break;
+        case 3: *s = -pc; *c = ps;  break;
+    }
+}
+
+static inline void exmath_sincosf(float ang, float *s, float *c)
+{
+#ifdef EXMATH_FAST_TRIG
+    exmath_sincosf_poly(ang, s, c);
+#else
+    *s = sinf(ang);
+    *c = cosf(ang);
+#endif
+}
 
 typedef union vec2f {
     struct { float x, y; };
@@ -104,4 +140,133 @@ static inline mat4 *mat4_translate(mat4 *m, vec3f a) {
     return m;
 }
 
+/*
+ * 2D affine transform, row-major 2x3:
+ *   | a  b  tx |
+ *   | c  d  ty |
+ * Same layout as a sprite instance, so it goes to the GPU as is.
+ * The in-place helpers multiply on the right like their mat4 counterparts.
+ */
+typedef union affine2d {
+    struct { float a, b, tx, c, d, ty; };
+    float v[6];
+} affine2d;
+
+#define AFFINE2D_IDENTITY { { 1.f, 0.f, 0.f,   0.f, 1.f, 0.f } }
+
+/* res = x * y, res may alias either */
+static inline affine2d *affine2d_mul(affine2d *res, const affine2d *x, const affine2d *y)
+{
+    affine2d r;
+
+    r.a  = x->a * y->a + x->b * y->c;
+    r.b  = x->a * y->b + x->b * y->d;
+    r.tx = x->a * y->tx + x->b * y->ty + x->tx;
+    r.c  = x->c * y->a + x->d * y->c;
+    r.d  = x->c * y->b + x->d * y->d;
+    r.ty = x->c * y->tx + x->d * y->ty + x->ty;
+
+    *res = r;
+    return res;
+}
+
+static inline affine2d *affine2d_translation(affine2d *res, vec2f t)
+{
+    *res = (affine2d) { { 1.f, 0.f, t.x,   0.f, 1.f, t.y } };
+    return res;
+}
+
+static inline affine2d *affine2d_rotation(affine2d *res, float ang)
+{
+    float c, s;
+    exmath_sincosf(ang, &s, &c);
+
+    *res = (affine2d) { { c, -s, 0.f,   s, c, 0.f } };
+    return res;
+}
+
+static inline affine2d *affine2d_scaling(affine2d *res, vec2f k)
+{
+    *res = (affine2d) { { k.x, 0.f, 0.f,   0.f, k.y, 0.f } };
+    return res;
+}
+
+static inline affine2d *affine2d_translate(affine2d *m, vec2f t)
+{
+    m->tx += m->a * t.x + m->b * t.y;
+    m->ty += m->c * t.x + m->d * t.y;
+    return m;
+}
+
+static inline affine2d *affine2d_rotate(affine2d *m, float ang)
+{
+    float c, s;
+    float a = m->a, b = m->b, cc = m->c, d = m->d;
+
+    exmath_sincosf(ang, &s, &c);
+    m->a = a * c + b * s;
+    m->b = b * c - a * s;
+    m->c = cc * c + d * s;
+    m->d = d * c - cc * s;
+    return m;
+}
+
+static inline affine2d *affine2d_scale(affine2d *m, vec2f k)
+{
+    m->a *= k.x; m->c *= k.x;
+    m->b *= k.y; m->d *= k.y;
+    return m;
+}
+
+static inline vec2f vec2f_apply_affine2d(vec2f p, const affine2d *m)
+{
+    return VEC2F(m->a * p.x + m->b * p.y + m->tx, m->c * p.x + m->d * p.y + m->ty);
+}
+
+/* returns NULL and leaves res alone if m is singular */
+static inline affine2d *affine2d_inverse(affine2d *res, const affine2d *m)
+{
+    float det = m->a * m->d - m->b * m->c;
+    float inv;
+    affine2d r;
+
+    if (det == 0.f)
+        return NULL;
+
+    inv = 1.f / det;
+    r.a  =  m->d * inv;
+    r.b  = -m->b * inv;
+    r.c  = -m->c * inv;
+    r.d  =  m->a * inv;
+    r.tx = -(r.a * m->tx + r.b * m->ty);
+    r.ty = -(r.c * m->tx + r.d * m->ty);
+
+    *res = r;
+    return res;
+}
+
+/* for uniforms, z passes through */
+mat4 *mat4_from_affine2d(mat4 *res, const affine2d *m);
+
+/* instruction sets of the kernels below, see exmath_simd.c */
+enum {
+    EXMATH_SIMD_SCALAR,
+    EXMATH_SIMD_4,              /* SSE or NEON */
+    EXMATH_SIMD_AVX2,           /* with FMA */
+    EXMATH_SIMD_COUNT
+};
+
+int         exmath_simd_available();
+int         exmath_simd_level();
+void        exmath_set_simd_level(int level);
+const char* exmath_simd_name(int level);
+
+/* out may be in, except for affine2d_mul_n where out[i] = x * y[i] must not overlap y */
+void        vec3f_apply_mat4_n(vec3f *out, const vec3f *in, size_t n, const mat4 *m);
+void        vec2f_apply_affine2d_n(vec2f *out, const vec2f *in, size_t n, const affine2d *m);
+void        affine2d_mul_n(affine2d *out, const affine2d *x, const affine2d *y, size_t n);
+
+/* always the polynomial, whatever EXMATH_FAST_TRIG says */
+void        exmath_sincosf_n(float *s, float *c, const float *ang, size_t n);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,339 @@
+#include "exmath.h"
+#include "simd.h"
+
+#include <string.h>
+
+#if defined(SIMD_SSE)
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+/*
+ * Matrix and batch kernels, one table per instruction set. The table is
+ * picked on first use from what the CPU supports, exmath_set_simd_level
+ * can force a lower one (for comparisons and bug hunting).
+ */
+
+typedef struct exmath_kernels {
+    void (*mat4_mul)(float *res, const float *a, const float *b);
+    void (*vec3f_apply_mat4_n)(vec3f *out, const vec3f *in, size_t n, const mat4 *m);
+    void (*vec2f_apply_affine2d_n)(vec2f *out, const vec2f *in, size_t n, const affine2d *m);
+    void (*affine2d_mul_n)(affine2d *out, const affine2d *x, const affine2d *y, size_t n);
+    void (*sincosf_n)(float *s, float *c, const float *ang, size_t n);
+} exmath_kernels_t;
+
+/* ****** *
+ * SCALAR *
+ * ****** */
+
+static void mat4_mul_scalar(float *res, const float *a, const float *b)
+{
+    float r[16];
+
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            r[j*4 + i] = a[j*4]*b[i] + a[j*4+1]*b[i+4] + a[j*4+2]*b[i+8] + a[j*4+3]*b[i+12];
+
+    memcpy(res, r, sizeof(r));
+}
+
+static void vec3f_apply_mat4_n_scalar(vec3f *out, const vec3f *in, size_t n, const mat4 *m)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = vec3f_apply_mat4(in[i], (mat4*)m);
+}
+
+static void vec2f_apply_affine2d_n_scalar(vec2f *out, const vec2f *in, size_t n, const affine2d *m)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = vec2f_apply_affine2d(in[i], m);
+}
+
+static void affine2d_mul_n_scalar(affine2d *out, const affine2d *x, const affine2d *y, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        affine2d_mul(&out[i], x, &y[i]);
+}
+
+static void sincosf_n_scalar(float *s, float *c, const float *ang, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        exmath_sincosf_poly(ang[i], &s[i], &c[i]);
+}
+
+/* ******************** *
+ * 4 LANES, SSE OR NEON *
+ * ******************** */
+
+/* rows of res are rows of a weighted by rows of b, b is loaded first so res may alias */
+static void mat4_mul_simd4(float *res, const float *a, const float *b)
+{
+    simd4f b0 = simd4f_load(b), b1 = simd4f_load(b + 4), b2 = simd4f_load(b + 8), b3 = simd4f_load(b + 12);
+    simd4f rows[4];
+
+    for (int j = 0; j < 4; j++) {
+        simd4f aj = simd4f_load(a + 4*j);
+        simd4f r = simd4f_mul(simd4f_lane(aj, 0), b0);
+        r = simd4f_madd(simd4f_lane(aj, 1), b1, r);
+        r = simd4f_madd(simd4f_lane(aj, 2), b2, r);
+        rows[j] = simd4f_madd(simd4f_lane(aj, 3), b3, r);
+    }
+
+    for (int j = 0; j < 4; j++)
+        simd4f_store(res + 4*j, rows[j]);
+}
+
+/* x, y, z, w at once from the matrix columns, then the perspective divide */
+static void vec3f_apply_mat4_n_simd4(vec3f *out, const vec3f *in, size_t n, const mat4 *m)
+{
+    const float *v = m->v;
+    simd4f c0 = simd4f_set(v[0], v[4], v[8], v[12]);
+    simd4f c1 = simd4f_set(v[1], v[5], v[9], v[13]);
+    simd4f c2 = simd4f_set(v[2], v[6], v[10], v[14]);
+    simd4f c3 = simd4f_set(v[3], v[7], v[11], v[15]);
+
+    for (size_t i = 0; i < n; i++) {
+        float r[4];
+        simd4f p = simd4f_madd(simd4f_splat(in[i].x), c0, c3);
+        p = simd4f_madd(simd4f_splat(in[i].y), c1, p);
+        p = simd4f_madd(simd4f_splat(in[i].z), c2, p);
+
+        simd4f_store(r, simd4f_div(p, simd4f_lane(p, 3)));
+        out[i] = VEC3F(r[0], r[1], r[2]);
+    }
+}
+
+/* two points per register, x0 y0 x1 y1 */
+static void vec2f_apply_affine2d_n_simd4(vec2f *out, const vec2f *in, size_t n, const affine2d *m)
+{
+    simd4f ac = simd4f_set(m->a, m->c, m->a, m->c);
+    simd4f bd = simd4f_set(m->b, m->d, m->b, m->d);
+    simd4f t = simd4f_set(m->tx, m->ty, m->tx, m->ty);
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        simd4f p = simd4f_load(in[i].v);
+        simd4f r = simd4f_madd(simd4f_dup_even(p), ac, t);
+        simd4f_store(out[i].v, simd4f_madd(simd4f_dup_odd(p), bd, r));
+    }
+
+    vec2f_apply_affine2d_n_scalar(out + i, in + i, n - i, m);
+}
+
+/*
+ * Each output row is x.a * (first row of y) + x.b * (second row of y) + x.tx.
+ * Rows are loaded 4 wide, so the fourth lane spills into the next element
+ * and the last one goes through the scalar path.
+ */
+static void affine2d_mul_n_simd4(affine2d *out, const affine2d *x, const affine2d *y, size_t n)
+{
+    simd4f xa = simd4f_splat(x->a), xb = simd4f_splat(x->b);
+    simd4f xc = simd4f_splat(x->c), xd = simd4f_splat(x->d);
+    simd4f t0 = simd4f_set(0.f, 0.f, x->tx, 0.f);
+    simd4f t1 = simd4f_set(0.f, 0.f, x->ty, 0.f);
+    size_t i = 0;
+
+    for (; i + 1 < n; i++) {
+        simd4f r0 = simd4f_load(y[i].v), r1 = simd4f_load(y[i].v + 3);
+        simd4f o0 = simd4f_madd(xb, r1, simd4f_madd(xa, r0, t0));
+        simd4f o1 = simd4f_madd(xd, r1, simd4f_madd(xc, r0, t1));
+
+        /* o0's last lane is garbage and gets overwritten by o1 */
+        simd4f_store(out[i].v, o0);
+        simd4f_store(out[i].v + 3, o1);
+    }
+
+    affine2d_mul_n_scalar(out + i, x, y + i, n - i);
+}
+
+/*
+ * exmath_sincosf_poly four at a time. The quadrant switch becomes
+ * arithmetic: with q mod 4 = 2 * hi + odd, odd swaps sin and cos and
+ * hi (or hi xor odd for cos) flips the sign.
+ */
+static void sincosf_n_simd4(float *s, float *c, const float *ang, size_t n)
+{
+    const simd4f one = simd4f_splat(1.f), two = simd4f_splat(2.f);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        simd4f a = simd4f_load(ang + i);
+        simd4f q = simd4f_round(simd4f_mul(a, simd4f_splat(0.63661977f)));
+        simd4f r = simd4f_madd(q, simd4f_splat(-1.5703125f), a);
+        simd4f r2, ps, pc, m, hi, odd, flip;
+
+        r = simd4f_madd(q, simd4f_splat(-4.837512969970703125e-4f), r);
+        r = simd4f_madd(q, simd4f_splat(-7.54978995489188216e-8f), r);
+        r2 = simd4f_mul(r, r);
+
+        ps = simd4f_madd(r2, simd4f_splat(-1.9515295891e-4f), simd4f_splat(8.3321608736e-3f));
+        ps = simd4f_madd(r2, ps, simd4f_splat(-1.6666654611e-1f));
+        ps = simd4f_madd(simd4f_mul(r, r2), ps, r);
+
+        pc = simd4f_madd(r2, simd4f_splat(2.443315711809948e-5f), simd4f_splat(-1.388731625493765e-3f));
+        pc = simd4f_madd(r2, pc, simd4f_splat(4.166664568298827e-2f));
+        pc = simd4f_madd(simd4f_mul(r2, r2), pc, simd4f_madd(r2, simd4f_splat(-0.5f), one));
+
+        /* floor(x) as round(x - 3/8) is exact for quarters, likewise round(x - 1/4) for halves */
+        m = simd4f_sub(q, simd4f_mul(simd4f_splat(4.f), simd4f_round(simd4f_madd(q, simd4f_splat(0.25f), simd4f_splat(-0.375f)))));
+        hi = simd4f_round(simd4f_madd(m, simd4f_splat(0.5f), simd4f_splat(-0.25f)));
+        odd = simd4f_sub(m, simd4f_mul(two, hi));
+        flip = simd4f_sub(simd4f_add(odd, hi), simd4f_mul(two, simd4f_mul(odd, hi)));
+
+        simd4f_store(s + i, simd4f_mul(simd4f_madd(odd, simd4f_sub(pc, ps), ps), simd4f_sub(one, simd4f_mul(two, hi))));
+        simd4f_store(c + i, simd4f_mul(simd4f_madd(odd, simd4f_sub(ps, pc), pc), simd4f_sub(one, simd4f_mul(two, flip))));
+    }
+
+    sincosf_n_scalar(s + i, c + i, ang + i, n - i);
+}
+
+/* **** *
+ * AVX2 *
+ * **** */
+
+#if defined(SIMD_SSE)
+
+/* four points per register, fused multiply-add */
+SIMD_TARGET_AVX2 static void vec2f_apply_affine2d_n_avx2(vec2f *out, const vec2f *in, size_t n, const affine2d *m)
+{
+    __m256 ac = _mm256_setr_ps(m->a, m->c, m->a, m->c, m->a, m->c, m->a, m->c);
+    __m256 bd = _mm256_setr_ps(m->b, m->d, m->b, m->d, m->b, m->d, m->b, m->d);
+    __m256 t = _mm256_setr_ps(m->tx, m->ty, m->tx, m->ty, m->tx, m->ty, m->tx, m->ty);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256 p = _mm256_loadu_ps(in[i].v);
+        __m256 r = _mm256_fmadd_ps(_mm256_moveldup_ps(p), ac, t);
+        _mm256_storeu_ps(out[i].v, _mm256_fmadd_ps(_mm256_movehdup_ps(p), bd, r));
+    }
+
+    vec2f_apply_affine2d_n_simd4(out + i, in + i, n - i, m);
+}
+
+#endif
+
+/* ******** *
+ * DISPATCH *
+ * ******** */
+
+static const exmath_kernels_t kernels[EXMATH_SIMD_COUNT] = {
+    [EXMATH_SIMD_SCALAR] = { mat4_mul_scalar, vec3f_apply_mat4_n_scalar, vec2f_apply_affine2d_n_scalar, affine2d_mul_n_scalar, sincosf_n_scalar },
+    [EXMATH_SIMD_4]      = { mat4_mul_simd4, vec3f_apply_mat4_n_simd4, vec2f_apply_affine2d_n_simd4, affine2d_mul_n_simd4, sincosf_n_simd4 },
+#if defined(SIMD_SSE)
+    /* 4x4 and 2x3 products gain nothing from 8 lanes */
+    [EXMATH_SIMD_AVX2]   = { mat4_mul_simd4, vec3f_apply_mat4_n_simd4, vec2f_apply_affine2d_n_avx2, affine2d_mul_n_simd4, sincosf_n_simd4 },
+#endif
+};
+
+static const char *level_names[EXMATH_SIMD_COUNT] = {
+    [EXMATH_SIMD_SCALAR]    = "scalar",
+#if defined(SIMD_SSE)
+    [EXMATH_SIMD_4]         = "sse",
+#elif defined(SIMD_NEON)
+    [EXMATH_SIMD_4]         = "neon",
+#else
+    [EXMATH_SIMD_4]         = "simd4 (emulated)",
+#endif
+    [EXMATH_SIMD_AVX2]      = "avx2",
+};
+
+static const exmath_kernels_t *active;
+static int active_level;
+
+/* AVX2 and FMA on the CPU, and the OS saving ymm registers */
+static int exmath_cpu_level()
+{
+#if defined(SIMD_SSE)
+    unsigned int r1[4] = { 0 }, r7[4] = { 0 };
+    unsigned long long xcr0 = 0;
+
+#if defined(_MSC_VER)
+    __cpuid((int*)r1, 1);
+    __cpuidex((int*)r7, 7, 0);
+    if (r1[2] & (1u << 27))
+        xcr0 = _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __get_cpuid(1, &r1[0], &r1[1], &r1[2], &r1[3]);
+    __get_cpuid_count(7, 0, &r7[0], &r7[1], &r7[2], &r7[3]);
+    if (r1[2] & (1u << 27)) {
+        __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        xcr0 = ((unsigned long long)hi << 32) | lo;
+    }
+#endif
+
+    if ((xcr0 & 6) == 6 && (r1[2] & (1u << 12)) && (r7[1] & (1u << 5)))
+        return EXMATH_SIMD_AVX2;
+    return EXMATH_SIMD_4;
+#elif defined(SIMD_NEON)
+    return EXMATH_SIMD_4;
+#else
+    return EXMATH_SIMD_SCALAR;
+#endif
+}
+
+int exmath_simd_available()
+{
+    static int level = -1;
+
+    if (level < 0)
+        level = exmath_cpu_level();
+    return level;
+}
+
+int exmath_simd_level()
+{
+    if (active == NULL)
+        exmath_set_simd_level(EXMATH_SIMD_COUNT);
+    return active_level;
+}
+
+/* clamped to what the CPU has */
+void exmath_set_simd_level(int level)
+{
+    int available = exmath_simd_available();
+
+    active_level = level < available ? (level < 0 ? 0 : level) : available;
+    active = &kernels[active_level];
+}
+
+const char* exmath_simd_name(int level)
+{
+    return level_names[level];
+}
+
+static inline const exmath_kernels_t* exmath_kernels()
+{
+    if (active == NULL)
+        exmath_set_simd_level(EXMATH_SIMD_COUNT);
+    return active;
+}
+
+mat4 *mat4_mul(mat4 *res, mat4 *a, mat4 *b)
+{
+    exmath_kernels()->mat4_mul(res->v, a->v, b->v);
+    return res;
+}
+
+void vec3f_apply_mat4_n(vec3f *out, const vec3f *in, size_t n, const mat4 *m)
+{
+    exmath_kernels()->vec3f_apply_mat4_n(out, in, n, m);
+}
+
+void vec2f_apply_affine2d_n(vec2f *out, const vec2f *in, size_t n, const affine2d *m)
+{
+    exmath_kernels()->vec2f_apply_affine2d_n(out, in, n, m);
+}
+
+void affine2d_mul_n(affine2d *out, const affine2d *x, const affine2d *y, size_t n)
+{
+    exmath_kernels()->affine2d_mul_n(out, x, y, n);
+}
+
+void exmath_sincosf_n(float *s, float *c, const float *ang, size_t n)
+{
+    exmath_kernels()->sincosf_n(s, c, ang, n);
+}
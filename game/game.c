@@ -33,8 +33,16 @@ uint32_t map_width, map_height;
 
 uint32_t tileset_width, tileset_height;
 textureid_t tileset_tx;
+gfx_chunk_cache_t tile_cache;
 textureid_t crosshair_tx;
 
+/* F3 toggles the stats overlay, F4 writes the profiler trace */
+bool show_stats;
+
+/* replaces the chase camera while set, see game_set_camera */
+bool camera_scripted;
+vec3f camera_pos;
+
 struct {
     gui_window_t win;
     gui_label_t label_hey;
@@ -44,29 +52,72 @@ struct {
     gui_element_t* sc_content[2];
 } sample_gui;
 
+#define TILE_SIZE   64.f
+#define CHUNK_SIZE  512
+
+/* tiles are opaque, no need to tint or discard */
+static void draw_tile_chunk(int32_t cx, int32_t cy, float size, void *user)
+{
+    int32_t x0 = max((int32_t)(cx * size / TILE_SIZE), 0);
+    int32_t y0 = max((int32_t)(cy * size / TILE_SIZE), 0);
+    int32_t x1 = min((int32_t)((cx + 1) * size / TILE_SIZE), (int32_t)map_width);
+    int32_t y1 = min((int32_t)((cy + 1) * size / TILE_SIZE), (int32_t)map_height);
+
+    gfx_set_layer(GFX_LAYER_TILES);
+    gfx_use_shader(0);
+    for (int32_t x = x0; x < x1; x++) {
+        for (int32_t y = y0; y < y1; y++) {
+            uint16_t tile = mapdata[x + y*map_width];
+            uint32_t tile_x = tile % tileset_width;
+            uint32_t tile_y = tile / tileset_width;
+
+            gfx_draw_2d_texture_rect(tileset_tx, x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE,
+                (float)tile_x / tileset_width, (float)tile_y / tileset_height,
+                1.f / tileset_width, 1.f / tileset_height);
+        }
+    }
+}
+
+/* every mapdata edit goes through here so the cached chunk gets redrawn */
+void game_set_tile(uint32_t x, uint32_t y, uint16_t tile)
+{
+    mapdata[x + y*map_width] = tile;
+    gfx_chunk_cache_invalidate_rect(&tile_cache, x * TILE_SIZE, y * TILE_SIZE, x * TILE_SIZE, y * TILE_SIZE);
+}
+
+/* world position to center the view on, NULL goes back to following the car */
+void game_set_camera(const vec3f *pos)
+{
+    camera_scripted = pos != NULL;
+    if (pos) camera_pos = *pos;
+}
+
 void game_init()
 {
-    car_model.tx = gfx_cache_texture("textures/car.png", TEXTURE_NEAREST_FILTER);
+    car_model.tx = gfx_cache_texture(asset_intern("textures/car.png"), TEXTURE_NEAREST_FILTER);
     car_model.engine_force_max = 50.f;
     audio_sample_create_from_wavfile(&car_model.engine_sound_sample, "sounds/car4f.wav");
 
     audio_sample_create_from_wavfile(&car_noises.tire_screech, "sounds/screech.wav");
+    gfx_emitter_create(&car_effects.smoke, gfx.puff_texture, 32768, VEC4F(0.85f, 0.85f, 0.85f, 0.5f), 0.9f);
+    gfx_emitter_create(&car_effects.debris, gfx.white_texture, 2048, VEC4F(0.25f, 0.22f, 0.2f, 1.f), 0.85f);
+    gfx_decal_layer_create(&car_effects.skids, 1024, 512, VEC4F(0.05f, 0.05f, 0.05f, 0.6f));
     
     car = (car_entity_t*)entity_create(&car_entity_vtable);
     car_entity_set_model(car, &car_model);
 
-    pedtype.texture = gfx_cache_texture("textures/ped.png", TEXTURE_NEAREST_FILTER);
+    pedtype.texture = gfx_cache_texture(asset_intern("textures/ped.png"), TEXTURE_NEAREST_FILTER);
     ped = (ped_entity_t*)entity_create(&ped_entity_vtable);
     ped->pos = VEC3F(100.f, 100.f, 0.f);
     ped_entity_set_type(ped, &pedtype);
 
     player.ped = ped;
 
-    crosshair_tx = gfx_cache_texture("textures/aim.png", TEXTURE_NEAREST_FILTER);
+    crosshair_tx = gfx_cache_texture(asset_intern("textures/aim.png"), TEXTURE_NEAREST_FILTER);
 
     tileset_width = 4;
     tileset_height = 115;
-    tileset_tx = gfx_cache_texture("textures/tiles.png", TEXTURE_NEAREST_FILTER);
+    tileset_tx = gfx_cache_texture(asset_intern("textures/tiles.png"), TEXTURE_NEAREST_FILTER);
 
     map_width = 256;
     map_height = 256;
@@ -75,10 +126,12 @@ void game_init()
     for (uint32_t i = 0; i < map_width * map_height; i++)
         mapdata[i] = rand() % (tileset_width*tileset_height);
 
-    *list_emplace_front(&entlist, base_entity_t*) = (base_entity_t*)car;
-    *list_emplace_front(&entlist, base_entity_t*) = (base_entity_t*)ped;
+    gfx_chunk_cache_create(&tile_cache, CHUNK_SIZE, draw_tile_chunk, NULL);
 
-    font_create(&font, gfx_cache_texture("textures/font.png", TEXTURE_NEAREST_FILTER), ' ', 20, 5, VEC3F(10, 24, 0));
+    list_link_front(&entlist, &car->node);
+    list_link_front(&entlist, &ped->node);
+
+    font_create(&font, gfx_cache_texture(asset_intern("textures/font.png"), TEXTURE_NEAREST_FILTER), ' ', 20, 5, VEC3F(10, 24, 0));
 
     sample_gui.sc_content[0] = &sample_gui.label_hey;
     sample_gui.sc_content[1] = &sample_gui.label_bye;
@@ -94,7 +147,10 @@ void game_init()
 void game_tick()
 {
     for (listnode_t* ent = entlist.begin; ent; ent = ent->next)
-        entity_tick(LISTNODE_DATA(ent, base_entity_t*));
+        entity_tick(LISTNODE_CONTAINER(ent, base_entity_t, node));
+
+    gfx_emitter_update(&car_effects.smoke);
+    gfx_emitter_update(&car_effects.debris);
 }
 
 void game_key_up(int key)
@@ -104,20 +160,29 @@ void game_key_up(int key)
 void game_key_down(int key)
 {
     if (key == KEY_ESCAPE) sys_close_window();
+    if (key == KEY_F3) show_stats = !show_stats;
+    if (key == KEY_F4 && !gfx_prof_write_trace("trace.json")) RENG_LOG("Failed to write trace.json");
 }
 
 void game_deinit()
 {
-    for (listnode_t* node = entlist.begin; node; node = node->next) {
-        entity_destroy(LISTNODE_DATA(node, base_entity_t*));
+    /* the node goes away with its entity */
+    for (listnode_t* node = entlist.begin, *next; node; node = next) {
+        next = node->next;
+        entity_destroy(LISTNODE_CONTAINER(node, base_entity_t, node));
     }
 
     audio_sample_destroy(&car_model.engine_sound_sample);
     audio_sample_destroy(&car_noises.tire_screech);
+    gfx_emitter_destroy(&car_effects.smoke);
+    gfx_emitter_destroy(&car_effects.debris);
+    gfx_decal_layer_destroy(&car_effects.skids);
 
     gui_destroy_elements(&sample_gui.win);
+    gfx_chunk_cache_destroy(&tile_cache);
+    sys_free(mapdata);
 
-    list_destroy(&entlist);
+    entlist = (list_t) { 0 };
 }
 
 float interpolate(float a, float b, float i)
@@ -127,80 +192,123 @@ float interpolate(float a, float b, float i)
 
 void game_draw()
 {
-    mat4 identity = MAT4_IDENTITY;
-    mat4 view;
+    affine2d identity = AFFINE2D_IDENTITY;
+    affine2d view;
+    vec2f view_min, view_max;
     
     /* view calculation */
     {
         base_entity_t* chase_entity = (base_entity_t*)car;
         float scale = 1.f;
         vec3f interpolated_pos = vec3f_neg(vec3f_sum(chase_entity->pos, vec3f_prod(chase_entity->velocity, sys.interpolation)));
-        mat4_translation(&view, VEC3F(sys.width / 2.f, sys.height / 2.f, 0.f));
-        mat4_scale(&view, VEC3F(scale, scale, 1));
-        mat4_translate(&view, interpolated_pos);
+        if (camera_scripted)
+            interpolated_pos = vec3f_neg(camera_pos);
+        affine2d_translation(&view, VEC2F(sys.width / 2.f, sys.height / 2.f));
+        affine2d_scale(&view, VEC2F(scale, scale));
+        affine2d_translate(&view, VEC2F(interpolated_pos.x, interpolated_pos.y));
+
+        /* world rect on screen */
+        view_min = VEC2F(-interpolated_pos.x - sys.width / 2.f / scale, -interpolated_pos.y - sys.height / 2.f / scale);
+        view_max = VEC2F(-interpolated_pos.x + sys.width / 2.f / scale, -interpolated_pos.y + sys.height / 2.f / scale);
     }
 
-    glDepthFunc(GL_ALWAYS);
+    gfx_state_set_depth(true, GL_ALWAYS);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
     gfx_setup_xy_screen_matrices();
-    glUniformMatrix4fv(shader.view_mat_location, 1, GL_TRUE, view.v);
-
-    
-    glBindTexture(GL_TEXTURE_2D, tileset_tx);
-    glBindVertexArray(shader.quad_vao);
-    for (uint32_t x = 0; x < 64; x++) {
-        for (uint32_t y = 0; y < 64; y++) {
-            uint16_t tile = mapdata[x + y*map_width];
-            uint32_t tile_x = tile % tileset_width;
-            uint32_t tile_y = tile / tileset_width;
-
-            mat4 modelmat;
-            mat4 texmat;
-
-            mat4_translation(&modelmat, VEC3F(x * 64.f, y * 64.f, 0.f));
-            mat4_scale(&modelmat, VEC3F(64.f, 64.f, 1.f));
-            mat4_translation(&texmat, VEC3F((float)tile_x / tileset_width, (float)tile_y / tileset_height, 0.f));
-            mat4_scale(&texmat, VEC3F(1.f / tileset_width, 1.f / tileset_height, 1.f));
-
-            glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, modelmat.v);
-            glUniformMatrix4fv(shader.textransform_mat_location, 1, GL_TRUE, texmat.v);
-            
-            glDrawArrays(GL_QUADS, 0, 4);
-        }
-    }
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
+    gfx_set_view_matrix(&view);
+
+    /* static tiles come from the chunk cache, only newly revealed chunks are redrawn */
+    gfx_prof_begin(GFX_LAYER_TILES);
+    gfx_set_layer(GFX_LAYER_TILES);
+    gfx_use_shader(0);
+    gfx_chunk_cache_draw(&tile_cache, view_min.x, view_min.y, view_max.x, view_max.y);
+    gfx_prof_end();
+
+    /* skid marks live in a few pages no matter how many there are */
+    gfx_prof_begin(GFX_LAYER_DECALS);
+    gfx_set_layer(GFX_LAYER_DECALS);
+    gfx_use_shader(0);
+    gfx_decal_layer_draw(&car_effects.skids, view_min.x, view_min.y, view_max.x, view_max.y);
+    gfx_prof_end();
+
+    gfx_prof_begin(GFX_LAYER_ENTITIES);
+    gfx_set_layer(GFX_LAYER_ENTITIES);
+
+    /* one instanced draw each, sorts before SHADER_ALPHA_DISCARD so it stays under the cars */
+    gfx_use_shader(SHADER_TINT);
+    gfx_emitter_draw(&car_effects.debris);
+    gfx_emitter_draw(&car_effects.smoke);
+
+    gfx_use_shader(SHADER_ALPHA_DISCARD);
     for (listnode_t* ent = entlist.begin; ent; ent = ent->next)
-        entity_draw(LISTNODE_DATA(ent, base_entity_t*));
-
-    glBindTexture(GL_TEXTURE_2D, shader.white_texture);
-    glBindVertexArray(shader.quad_vao);
+        entity_draw(LISTNODE_CONTAINER(ent, base_entity_t, node));
+    gfx_prof_end();
 
     /* 
      * GUI
      */
-    glUniformMatrix4fv(shader.view_mat_location, 1, GL_TRUE, identity.v);
+    gfx_prof_begin(GFX_LAYER_GUI);
+    gfx_set_layer(GFX_LAYER_GUI);
+    gfx_set_view_matrix(&identity);
 
+    gfx_use_shader(SHADER_ALPHA_DISCARD);
     gfx_draw_2d_texture(crosshair_tx, sys.mouse.x - 16.f, sys.mouse.y - 16.f, 32.f, 32.f);
 
     gui_context_t guictx;
     guictx.pos = VEC2F(0.f, 0.f);
 
     gui_draw_element(&sample_gui.win, &guictx);
+    gfx_prof_end();
+
+    if (!show_stats)
+        return;
 
-    str8 str;
-    str8_create_by_printf(&str,
+    /* stays in the stack buffer, no allocations per frame */
+    char text[1024];
+    str8 hud;
+    str8_create_on_buffer(&hud, text, sizeof(text));
+
+    str8_append_fmt(&hud,
         "speed: %d (units per tick)\n"
         "engine_force: %.2f\n"
+        "gl calls: %u issued, %u skipped\n"
+        "textures: %u resident, %u/%u KB, %u evicted\n"
+        "tile chunks redrawn: %u\n"
+        "particles: %u\n"
+        "skid pages recycled: %u\n"
+        "world scale: %.2f (%s)\n"
         ,
         (int)vec3f_len(car->velocity),
-        car->engine_force
+        car->engine_force,
+        gfx.state.last_frame.issued,
+        gfx.state.last_frame.skipped,
+        gfx.textures.n_resident,
+        (uint32_t)(gfx.textures.resident_bytes >> 10),
+        (uint32_t)(gfx.textures.budget_bytes >> 10),
+        gfx.textures.n_evicted,
+        tile_cache.n_rendered,
+        car_effects.smoke.count + car_effects.debris.count,
+        car_effects.skids.n_recycled,
+        gfx.dynres.scale,
+        gfx.dynres.enabled ? "dynamic" : "fixed"
     );
 
-    //gfx_draw_text(str.data, &font, VEC3F(5.f, 5.f, 0.f), VEC3F(1.f, 1.f, 0.f));
-    str8_destroy(&str);
+    /* CPU is recording here plus submit, GPU is a few frames old */
+    for (uint32_t i = 0; i < GFX_LAYER_COUNT; i++) {
+        const char *name = gfx_layer_name(i);
+        size_t name_len = strlen(name);
+
+        str8_append_n(&hud, name, name_len);
+        str8_append_n(&hud, "        ", name_len < 8 ? 8 - name_len : 0);
+        str8_append(&hud, " cpu ");
+        str8_append_float(&hud, gfx.prof.cpu_ms[i], 2);
+        str8_append(&hud, " ms, gpu ");
+        str8_append_float(&hud, gfx.prof.gpu_ms[i], 2);
+        str8_append(&hud, " ms\n");
+    }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    gfx_prof_begin(GFX_LAYER_TEXT);
+    gfx_draw_text(hud.data, &font, VEC3F(5.f, 5.f, 0.f), VEC3F(1.f, 1.f, 0.f));
+    gfx_prof_end();
+    str8_destroy(&hud);
 }
\ No newline at end of file
@@ -11,5 +11,7 @@ void game_key_up(int key);
 void game_key_down(int key);
 void game_deinit();
 void game_draw();
+void game_set_tile(uint32_t x, uint32_t y, uint16_t tile);
+void game_set_camera(const vec3f *pos);
 
 #endif
\ No newline at end of file
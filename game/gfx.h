@@ -5,6 +5,7 @@
 
 #include "sys.h"
 #include "exmath.h"
+#include "asset.h"
 
 typedef unsigned int textureid_t;
 
@@ -15,7 +16,7 @@ typedef struct font {
     int col_len; // 5
     vec3f letter_size; // z component is ignored)
 
-    mat4 modelmat, texmat;
+    vec2f uvsize;
 } font_t;
 
 /* Does not allocate anything. you`re free to leave it "undestroyed"  */
@@ -28,35 +29,441 @@ typedef struct glvertex {
     rgbaf color;
 } glvertex_t;
 
+/* shader variant flags, any combination is a valid variant */
+enum {
+    SHADER_TINT             = (1 << 0),     /* multiply by vertex color and gfx_set_color() */
+    SHADER_ALPHA_DISCARD    = (1 << 1),     /* discard texels with alpha < 0.1 */
+    SHADER_VARIANT_COUNT    = (1 << 2)
+};
+
 typedef struct shader {
     GLuint program;
-    GLuint quad_vbo, quad_vao;
-    GLuint model_mat_location;
-    GLuint view_mat_location;
-    GLuint proj_mat_location;
-    GLuint color_location;
-    GLuint textransform_mat_location;
-    GLuint white_texture;
+    GLint proj_mat_location;
+
+    /* last uploaded values */
+    mat4 proj;
+    bool uniforms_valid;
 } shader_t;
 
+/* model shader, see gfx_draw_geometry */
+typedef struct mesh_shader {
+    GLuint program;
+    GLint mvp_location;
+    GLint color_location;
+} mesh_shader_t;
+
+/* not one of gfx.shaders, the command draws cmd->mesh with gfx.mesh_shader */
+#define GFX_VARIANT_MESH SHADER_VARIANT_COUNT
+
+struct geometry;
+
+/* one sprite of an instanced batch, 44 bytes */
+typedef struct gfx_instance {
+    affine2d xform;             /* view already applied */
+    float texrect[4];           /* uv offset and uv scale, any range so uvs can repeat or flip */
+    uint8_t tint[4];            /* rgba8 */
+} gfx_instance_t;
+
+#define GFX_MAX_INSTANCES 8192
+#define GFX_INSTANCE_RING (4 * GFX_MAX_INSTANCES)   /* instances in the streaming buffer */
+#define GFX_TEXTURE_UNITS 8
+
+/* layers are drawn in this order */
+typedef enum gfx_layer {
+    GFX_LAYER_TILES,
+    GFX_LAYER_DECALS,           /* persistent marks on the ground, see gfx/decals.c */
+    GFX_LAYER_ENTITIES,
+    GFX_LAYER_GUI,              /* translucent, keeps submission order */
+    GFX_LAYER_TEXT,             /* gfx_draw_text, above all GUI */
+    GFX_LAYER_COUNT
+} gfx_layer_t;
+
+#define GFX_LAYER_IS_ORDERED(layer) ((layer) >= GFX_LAYER_GUI)
+
+/* one recorded sprite, a whole batch or a mesh, view is already baked into the xforms */
+typedef struct gfx_cmd {
+    uint64_t key;
+    textureid_t tx;
+    uint32_t variant;
+    uint32_t n_instances;       /* 0 for a single sprite in inst */
+    union {
+        gfx_instance_t inst;
+        const gfx_instance_t *instances;    /* owned by the caller until gfx_submit */
+        struct {
+            const struct geometry *geometry;
+            const mat4 *mvp;                /* owned by the caller until gfx_submit */
+        } mesh;
+    };
+} gfx_cmd_t;
+
+/* 
+ * Commands are plain memory and don't touch GL until gfx_submit. Drawing
+ * records into gfx.queue, offscreen passes swap their own buffer in.
+ */
+typedef struct gfx_cmdbuf {
+    gfx_cmd_t *cmds;
+    uint32_t size;
+    uint32_t capacity;
+} gfx_cmdbuf_t;
+
+/* frame recording state saved around a pass into another target, see gfx_offscreen_begin */
+typedef struct gfx_offscreen {
+    gfx_cmdbuf_t *queue;
+    gfx_cmdbuf_t frame_queue;
+    affine2d view;
+    mat4 proj;
+    rgbaf color;
+    gfx_layer_t layer;
+    uint32_t variant;
+    uint16_t depth;
+    GLuint framebuffer;
+    GLint viewport[4];
+} gfx_offscreen_t;
+
+typedef struct gfx_sort_item {
+    uint64_t key;
+    uint32_t index;
+} gfx_sort_item_t;
+
+typedef struct gfx_state_stats {
+    uint32_t issued;
+    uint32_t skipped;
+    uint32_t draw_calls;
+    uint32_t vertices;          /* indices for indexed draws */
+} gfx_state_stats_t;
+
+/* what we believe is bound right now, see gfx_state_* */
+typedef struct gfx_state {
+    GLuint program;
+    GLuint vao;
+    GLuint array_buffer;
+    GLuint framebuffer;
+    GLint viewport[4];
+    GLuint active_unit;
+    GLuint textures[GFX_TEXTURE_UNITS];
+
+    GLuint blend;
+    GLenum blend_src, blend_dst;
+    GLuint depth_test;
+    GLenum depth_func;
+
+    gfx_state_stats_t frame;
+    gfx_state_stats_t last_frame;
+} gfx_state_t;
+
+/* per layer timings of one frame, GFX_PROF_LATENCY frames old, see gfx/profiler.c */
+#define GFX_PROF_LATENCY        4
+#define GFX_PROF_MAX_SCOPES     32      /* per frame */
+#define GFX_PROF_HISTORY        128     /* frames kept for gfx_prof_write_trace */
+
+typedef struct gfx_prof_stats {
+    uint64_t frame;
+    float cpu_ms[GFX_LAYER_COUNT];
+    float gpu_ms[GFX_LAYER_COUNT];
+    uint32_t n_lost;            /* scopes whose GPU result wasn't ready in time */
+} gfx_prof_stats_t;
+
+/* world layers rendered at a scale that tracks a GPU time budget, see gfx/dynres.c */
+#define GFX_DYNRES_MIN_SCALE    0.5f
+#define GFX_DYNRES_STEP         (1.f / 32.f)
+#define GFX_DYNRES_DAMPING      0.25f
+
+typedef struct gfx_dynres {
+    bool enabled;
+    float target_ms;            /* for all world layers together */
+    float scale;
+
+    GLuint fbo;
+    textureid_t color, depth;
+    GLsizei width, height;      /* of the target, the native viewport size */
+    GLsizei scaled_width, scaled_height;
+
+    /* where the world gets blitted to */
+    GLuint native_fbo;
+    GLint native_viewport[4];
+    bool submitting;            /* gfx_end_frame's submit, not a chunk render */
+} gfx_dynres_t;
+
+/* see gfx/residency.c */
+typedef struct gfx_texture_stats {
+    size_t resident_bytes;
+    size_t budget_bytes;
+    uint32_t n_resident;
+    uint32_t n_evicted;
+} gfx_texture_stats_t;
+
+typedef struct gfx_common {
+    GLuint quad_vbo, quad_ebo, quad_vao;
+    GLuint instance_vbo;
+    uint32_t instance_capacity;     /* of instance_vbo, grows for batches bigger than the ring */
+    uint32_t instance_head;         /* next free instance, draws before it may still be in flight */
+    GLuint white_texture;
+    GLuint puff_texture;        /* soft round particle, see gfx/particles.c */
+
+    shader_t shaders[SHADER_VARIANT_COUNT];
+    shader_t *shader;
+    mesh_shader_t mesh_shader;
+
+    /* recording state, applied to every pushed sprite */
+    uint32_t variant;
+    gfx_layer_t layer;
+    uint16_t depth;
+    affine2d view;
+    rgbaf color;
+    uint8_t tint[4];
+
+    /* projection is shared by the whole frame */
+    mat4 proj;
+
+    gfx_state_t state;
+    gfx_texture_stats_t textures;
+    gfx_prof_stats_t prof;
+    gfx_dynres_t dynres;
+    uint64_t frame_index;
+
+    /* this frame's commands, sorted and drawn by gfx_submit */
+    gfx_cmdbuf_t queue;
+    gfx_sort_item_t *sort_items, *sort_tmp;
+    uint32_t sort_capacity;
+
+    /* sorted sprites are batched until texture or shader change */
+    gfx_instance_t *batch;
+    uint32_t batch_size;
+    textureid_t batch_tx;
+} gfx_common_t;
+
+/* static world layers cached in render targets, see gfx/chunkcache.c */
+#define GFX_CHUNK_GRID  8       /* slots per axis, the screen must fit in GRID - 1 chunks */
+
+typedef void (*gfx_chunk_draw_fn)(int32_t cx, int32_t cy, float size, void *user);
+
+typedef struct gfx_chunk {
+    int32_t cx, cy;
+    bool valid;
+    GLuint fbo;
+    textureid_t tx;
+} gfx_chunk_t;
+
+typedef struct gfx_chunk_cache {
+    gfx_chunk_t slots[GFX_CHUNK_GRID][GFX_CHUNK_GRID];
+    uint32_t size;              /* of a chunk, in world units and texels alike */
+    gfx_chunk_draw_fn draw;     /* records the sprites of one chunk, in world coordinates */
+    void *user;
+    gfx_cmdbuf_t queue;
+    uint32_t n_rendered;        /* by the last gfx_chunk_cache_draw */
+} gfx_chunk_cache_t;
+
+/* world-aligned pages that marks are stamped into once, see gfx/decals.c */
+#define GFX_DECAL_PAGES 16
+
+typedef struct gfx_decal_page {
+    int32_t px, py;
+    bool used;
+    bool dirty;                 /* has pending stamps */
+    uint64_t last_used;         /* frame it was last drawn or stamped */
+    GLuint fbo;
+    textureid_t tx;
+} gfx_decal_page_t;
+
+/* a line segment of given width, alpha is the only per stamp color */
+typedef struct gfx_decal_stamp {
+    vec2f from, to;
+    float width;
+    float alpha;
+} gfx_decal_stamp_t;
+
+typedef struct gfx_decal_layer {
+    gfx_decal_page_t pages[GFX_DECAL_PAGES];
+    uint32_t size;              /* of a page in world units */
+    uint32_t resolution;        /* of a page in texels */
+    rgbaf color;
+
+    gfx_decal_stamp_t *stamps;  /* pending until the next gfx_decal_layer_draw */
+    uint32_t n_stamps, stamps_capacity;
+    gfx_cmdbuf_t queue;
+    uint32_t n_recycled;
+} gfx_decal_layer_t;
+
+/*
+ * Particles of one texture, stored as arrays per attribute so the update
+ * runs four at a time. Units are world units and ticks, like entities.
+ */
+typedef struct gfx_emitter {
+    textureid_t tx;
+    rgbaf color;                /* alpha fades to 0 over the lifetime */
+    float drag;                 /* velocity multiplier per tick */
+
+    uint32_t count;
+    uint32_t capacity;          /* multiple of 4 */
+    float *x, *y, *vx, *vy;
+    float *size, *growth;       /* growth is added to size every tick */
+    float *age, *inv_life;
+    float *alpha;
+    gfx_instance_t *instances;  /* filled by gfx_emitter_draw */
+} gfx_emitter_t;
+
+/* uv offset in xy, uv scale in zw */
+#define GFX_FULL_TEXRECT VEC4F(0.f, 0.f, 1.f, 1.f)
+
 enum {
     TEXTURE_LINEAR_FILTER,
     TEXTURE_NEAREST_FILTER
 };
 
-extern shader_t shader;
+/* texel formats of cooked textures, see gfx/texcache.c */
+enum {
+    GFX_COOKED_RGBA8,
+    GFX_COOKED_RGB565,
+    GFX_COOKED_RGBA4444,
+    GFX_COOKED_FORMAT_COUNT
+};
+
+/* header and mip chain, either mapped from disk or freshly cooked */
+typedef struct gfx_cooked_texture {
+    uint8_t *data;
+    size_t size;
+    bool mapped;
+} gfx_cooked_texture_t;
+
+extern gfx_common_t gfx;
 
 #define GL_EXT_MACRO(x, caps) extern PFN##caps##PROC x;
 #include "gl_extensions.h"
 
+/* plain textured variant, nothing drawn with it overlaps so the order is free */
+#define GFX_VARIANT_IS_OPAQUE(variant) ((variant) == 0)
+
+/*
+ * Unordered layers sort by shader first. Opaque variants then go by texture
+ * to batch as much as possible, the others by depth and then submission
+ * order, so overlapping translucent sprites blend the way they were drawn.
+ * Ordered layers sort by depth only. The sort is stable, equal keys keep
+ * submission order.
+ */
+static inline uint64_t gfx_make_sort_key(gfx_layer_t layer, uint32_t variant, textureid_t tx, uint16_t depth)
+{
+    if (GFX_LAYER_IS_ORDERED(layer))
+        return (uint64_t)layer << 56 | (uint64_t)depth << 40;
+
+    if (GFX_VARIANT_IS_OPAQUE(variant))
+        return (uint64_t)layer << 56 | (uint64_t)tx << 16 | depth;
+
+    return (uint64_t)layer << 56 | (uint64_t)(variant & 0xFF) << 48 | (uint64_t)depth << 32;
+}
+
+void            gfx_cmdbuf_create(gfx_cmdbuf_t *buf);
+void            gfx_cmdbuf_destroy(gfx_cmdbuf_t *buf);
+gfx_cmd_t*      gfx_cmdbuf_push(gfx_cmdbuf_t *buf);
+void            gfx_sort_keys(gfx_sort_item_t *items, gfx_sort_item_t *tmp, uint32_t n);
+void            gfx_submit();
+void            gfx_offscreen_begin(gfx_offscreen_t *o, gfx_cmdbuf_t *queue, GLuint fbo, GLsizei w, GLsizei h);
+void            gfx_offscreen_end(gfx_offscreen_t *o);
+
+void            gfx_prof_init();
+void            gfx_prof_deinit();
+void            gfx_prof_begin_frame();
+void            gfx_prof_begin(gfx_layer_t pass);
+void            gfx_prof_end();
+bool            gfx_prof_write_trace(const char *path);
+const char*     gfx_layer_name(gfx_layer_t layer);
+
+void            gfx_dynres_enable(float target_ms);
+void            gfx_dynres_disable();
+void            gfx_dynres_deinit();
+void            gfx_dynres_update();
+void            gfx_dynres_begin_world();
+void            gfx_dynres_end_world();
+
+void            gfx_decal_layer_create(gfx_decal_layer_t *layer, uint32_t size, uint32_t resolution, rgbaf color);
+void            gfx_decal_layer_destroy(gfx_decal_layer_t *layer);
+void            gfx_decal_stamp(gfx_decal_layer_t *layer, vec2f from, vec2f to, float width, float alpha);
+void            gfx_decal_layer_draw(gfx_decal_layer_t *layer, float x0, float y0, float x1, float y1);
+
+void            gfx_particles_init();
+void            gfx_particles_deinit();
+void            gfx_emitter_create(gfx_emitter_t *e, textureid_t tx, uint32_t capacity, rgbaf color, float drag);
+void            gfx_emitter_destroy(gfx_emitter_t *e);
+void            gfx_emitter_spawn(gfx_emitter_t *e, vec2f pos, vec2f vel, float size, float growth, uint32_t life);
+void            gfx_emitter_update(gfx_emitter_t *e);
+void            gfx_emitter_draw(gfx_emitter_t *e);
+
+void            gfx_chunk_cache_create(gfx_chunk_cache_t *cache, uint32_t size, gfx_chunk_draw_fn draw, void *user);
+void            gfx_chunk_cache_destroy(gfx_chunk_cache_t *cache);
+void            gfx_chunk_cache_invalidate(gfx_chunk_cache_t *cache);
+void            gfx_chunk_cache_invalidate_rect(gfx_chunk_cache_t *cache, float x0, float y0, float x1, float y1);
+void            gfx_chunk_cache_draw(gfx_chunk_cache_t *cache, float x0, float y0, float x1, float y1);
+
 void            gfx_init();
 void            gfx_deinit();
+void            gfx_begin_frame();
+void            gfx_end_frame();
+
+void            gfx_state_invalidate();
+void            gfx_state_use_program(GLuint program);
+void            gfx_state_bind_vao(GLuint vao);
+void            gfx_state_bind_array_buffer(GLuint buffer);
+void            gfx_state_bind_framebuffer(GLuint fbo);
+void            gfx_state_set_viewport(GLint x, GLint y, GLsizei w, GLsizei h);
+void            gfx_state_bind_texture(uint32_t unit, textureid_t tx);
+void            gfx_state_forget_texture(textureid_t tx);
+void            gfx_state_forget_buffer(GLuint buffer);
+void            gfx_state_forget_vao(GLuint vao);
+void            gfx_state_set_blend(bool enable, GLenum src, GLenum dst);
+void            gfx_state_set_depth(bool enable, GLenum func);
+void            gfx_state_uniform_mat4(GLint location, mat4 *cache, bool cache_valid, const mat4 *m);
+
+void            gfx_use_shader(uint32_t variant);
+void            gfx_set_layer(gfx_layer_t layer);
+void            gfx_set_depth(uint16_t depth);
+void            gfx_set_view_matrix(const affine2d *view);
+void            gfx_set_proj_matrix(mat4 *proj);
+void            gfx_set_color(rgbaf color);
+void            gfx_flush_globals();
+void            gfx_flush();
+void            gfx_draw_instances(textureid_t tx, const gfx_instance_t *instances, uint32_t n);
+void            gfx_push_instances(textureid_t tx, const gfx_instance_t *instances, uint32_t n);
+void            gfx_draw_geometry(const struct geometry *g, const mat4 *mvp);
+void            gfx_push_geometry(const struct geometry *g, const mat4 *mvp);
+void            gfx_draw_sprite(textureid_t tx, const affine2d *xform, vec4f texrect);
 void            gfx_draw_2d_texture_rect(textureid_t tx, float x, float y, float sx, float sy, float txx, float txy, float txscalex, float txscaley);
 void            gfx_draw_2d_texture(textureid_t tx, float x, float y, float sx, float sy);
 void            gfx_draw_text(char *str, font_t *font, vec3f pos, vec3f color);
 void            gfx_setup_xy_screen_matrices();
-textureid_t     gfx_cache_texture(char *name, unsigned int filter);
-void            gfx_uncache_texture(char *name);
-textureid_t     gfx_load_texture(char *name, unsigned int filter);
+textureid_t     gfx_load_texture(char *name, unsigned int filter, size_t *bytes);
+void            gfx_set_texture_params(unsigned int filter);
+
+/* refcounted texture cache keyed by interned path, see gfx/residency.c */
+#define GFX_TEXTURE_BUDGET      ((size_t)256 << 20)
+
+void            gfx_residency_init();
+void            gfx_residency_deinit();
+void            gfx_residency_collect();
+void            gfx_residency_charge(size_t bytes);
+void            gfx_residency_refund(size_t bytes);
+textureid_t     gfx_cache_texture(asset_id_t id, unsigned int filter);
+textureid_t     gfx_cache_texture_async(asset_id_t id, unsigned int filter);
+void            gfx_uncache_texture(asset_id_t id);
+void            gfx_release_texture(textureid_t tx);
+void            gfx_set_texture_bytes(textureid_t tx, size_t bytes);
+void            gfx_set_texture_budget(size_t bytes);
+
+/* async loading, see gfx/texstream.c */
+#define GFX_STREAM_WORKERS      2
+#define GFX_STREAM_BUDGET_USEC  2000        /* upload time per frame */
+
+void            gfx_stream_init();
+void            gfx_stream_deinit();
+void            gfx_stream_update(uint64_t budget_usec);
+textureid_t     gfx_stream_texture(const char *path, unsigned int filter);
+void            gfx_stream_cancel(textureid_t tx);
+uint32_t        gfx_stream_pending();
+
+bool            gfx_cooked_open(const char *path, gfx_cooked_texture_t *ct);
+void            gfx_cooked_close(gfx_cooked_texture_t *ct);
+void            gfx_cooked_drop_levels(gfx_cooked_texture_t *ct);
+void            gfx_cooked_upload(const gfx_cooked_texture_t *ct);
+void            gfx_cooked_upload_level(const gfx_cooked_texture_t *ct, uint32_t level, const uint8_t *base);
+uint32_t        gfx_cooked_levels(const gfx_cooked_texture_t *ct);
+size_t          gfx_cooked_bytes(const gfx_cooked_texture_t *ct);
 
 #endif
\ No newline at end of file
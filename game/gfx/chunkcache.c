@@ -0,0 +1,158 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+#include "../exmath.h"
+
+/*
+ * Static layers are rendered once into size x size world chunks, one
+ * texture each, and composited with a quad per visible chunk. Slots form
+ * a toroidal grid (chunk cx lives in slot cx mod GFX_CHUNK_GRID), so when
+ * the camera scrolls only the newly revealed chunks are re-rendered.
+ */
+
+static inline int32_t gfx_floor_div(float v, uint32_t size)
+{
+    return (int32_t)floorf(v / size);
+}
+
+static inline uint32_t gfx_chunk_slot(int32_t c)
+{
+    return (uint32_t)(((c % GFX_CHUNK_GRID) + GFX_CHUNK_GRID) % GFX_CHUNK_GRID);
+}
+
+static inline size_t gfx_chunk_bytes(uint32_t size)
+{
+    return (size_t)4 * size * size;
+}
+
+void gfx_chunk_cache_create(gfx_chunk_cache_t *cache, uint32_t size, gfx_chunk_draw_fn draw, void *user)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->size = size;
+    cache->draw = draw;
+    cache->user = user;
+    gfx_cmdbuf_create(&cache->queue);
+}
+
+void gfx_chunk_cache_destroy(gfx_chunk_cache_t *cache)
+{
+    for (uint32_t y = 0; y < GFX_CHUNK_GRID; y++) {
+        for (uint32_t x = 0; x < GFX_CHUNK_GRID; x++) {
+            gfx_chunk_t *c = &cache->slots[y][x];
+            if (c->tx == 0)
+                continue;
+
+            glDeleteFramebuffers(1, &c->fbo);
+            gfx_state_forget_texture(c->tx);
+            glwrapDeleteTextures(1, &c->tx);
+            gfx_residency_refund(gfx_chunk_bytes(cache->size));
+        }
+    }
+
+    gfx_cmdbuf_destroy(&cache->queue);
+}
+
+void gfx_chunk_cache_invalidate(gfx_chunk_cache_t *cache)
+{
+    for (uint32_t y = 0; y < GFX_CHUNK_GRID; y++)
+        for (uint32_t x = 0; x < GFX_CHUNK_GRID; x++)
+            cache->slots[y][x].valid = false;
+}
+
+/* drops the chunks touching the world rect, they are redrawn when next seen */
+void gfx_chunk_cache_invalidate_rect(gfx_chunk_cache_t *cache, float x0, float y0, float x1, float y1)
+{
+    for (int32_t cy = gfx_floor_div(y0, cache->size); cy <= gfx_floor_div(y1, cache->size); cy++) {
+        for (int32_t cx = gfx_floor_div(x0, cache->size); cx <= gfx_floor_div(x1, cache->size); cx++) {
+            gfx_chunk_t *c = &cache->slots[gfx_chunk_slot(cy)][gfx_chunk_slot(cx)];
+            if (c->cx == cx && c->cy == cy)
+                c->valid = false;
+        }
+    }
+}
+
+/* leaves the current render target bound */
+static void gfx_chunk_create_target(gfx_chunk_t *c, uint32_t size)
+{
+    GLuint framebuffer = gfx.state.framebuffer;
+
+    glwrapGenTextures(1, &c->tx);
+    gfx_state_bind_texture(0, c->tx);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    gfx_residency_charge(gfx_chunk_bytes(size));
+
+    glGenFramebuffers(1, &c->fbo);
+    gfx_state_bind_framebuffer(c->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->tx, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        RENG_LOG("Chunk framebuffer is incomplete");
+
+    gfx_state_bind_framebuffer(framebuffer);
+}
+
+/*
+ * Renders one chunk through its own queue, so whatever the frame has
+ * recorded so far stays put. World y grows down while texture rows grow
+ * up, the projection flips y so the composite quad needs no flipped uvs.
+ */
+static void gfx_chunk_render(gfx_chunk_cache_t *cache, gfx_chunk_t *c, int32_t cx, int32_t cy)
+{
+    gfx_offscreen_t pass;
+    affine2d view, ndc;
+    mat4 proj;
+
+    if (c->tx == 0)
+        gfx_chunk_create_target(c, cache->size);
+
+    c->cx = cx;
+    c->cy = cy;
+    c->valid = true;
+    cache->n_rendered++;
+
+    /* the composite blends chunks over whatever is below, so empty texels must stay transparent */
+    gfx_offscreen_begin(&pass, &cache->queue, c->fbo, cache->size, cache->size);
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    affine2d_translation(&ndc, VEC2F(-1.f, -1.f));
+    affine2d_scale(&ndc, VEC2F(2.f / cache->size, 2.f / cache->size));
+    mat4_from_affine2d(&proj, &ndc);
+    affine2d_translation(&view, VEC2F(-(float)cx * cache->size, -(float)cy * cache->size));
+
+    gfx_set_proj_matrix(&proj);
+    gfx_set_view_matrix(&view);
+    cache->draw(cx, cy, (float)cache->size, cache->user);
+    gfx_offscreen_end(&pass);
+}
+
+/*
+ * Brings every chunk in the visible world rect up to date and records a
+ * quad for each with the current layer and shader. The rect is clamped to
+ * GFX_CHUNK_GRID chunks per axis, past that slots would alias.
+ */
+void gfx_chunk_cache_draw(gfx_chunk_cache_t *cache, float x0, float y0, float x1, float y1)
+{
+    int32_t cx0 = gfx_floor_div(x0, cache->size), cy0 = gfx_floor_div(y0, cache->size);
+    int32_t cx1 = min(gfx_floor_div(x1, cache->size), cx0 + GFX_CHUNK_GRID - 1);
+    int32_t cy1 = min(gfx_floor_div(y1, cache->size), cy0 + GFX_CHUNK_GRID - 1);
+
+    cache->n_rendered = 0;
+
+    for (int32_t cy = cy0; cy <= cy1; cy++) {
+        for (int32_t cx = cx0; cx <= cx1; cx++) {
+            gfx_chunk_t *c = &cache->slots[gfx_chunk_slot(cy)][gfx_chunk_slot(cx)];
+
+            if (!c->valid || c->cx != cx || c->cy != cy)
+                gfx_chunk_render(cache, c, cx, cy);
+
+            gfx_draw_2d_texture(c->tx, (float)cx * cache->size, (float)cy * cache->size, (float)cache->size, (float)cache->size);
+        }
+    }
+}
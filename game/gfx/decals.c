@@ -0,0 +1,222 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+#include "../exmath.h"
+
+/*
+ * Decals are stamped into world-aligned pages once and the pages are drawn
+ * as a quad each, so the cost doesn't depend on how many marks there are.
+ * A layer holds GFX_DECAL_PAGES pages, when a stamp lands outside all of
+ * them the least recently used page is cleared and moved there.
+ *
+ * Pages are cleared to the layer color with zero alpha and stamps blend
+ * premultiplied, so color stays put and only coverage accumulates. The
+ * page then composites with the regular alpha blending.
+ */
+
+static inline int32_t gfx_decal_floor_div(float v, uint32_t size)
+{
+    return (int32_t)floorf(v / size);
+}
+
+void gfx_decal_layer_create(gfx_decal_layer_t *layer, uint32_t size, uint32_t resolution, rgbaf color)
+{
+    memset(layer, 0, sizeof(*layer));
+    layer->size = size;
+    layer->resolution = resolution;
+    layer->color = color;
+    gfx_cmdbuf_create(&layer->queue);
+}
+
+void gfx_decal_layer_destroy(gfx_decal_layer_t *layer)
+{
+    for (uint32_t i = 0; i < GFX_DECAL_PAGES; i++) {
+        gfx_decal_page_t *p = &layer->pages[i];
+        if (p->tx == 0)
+            continue;
+
+        glDeleteFramebuffers(1, &p->fbo);
+        gfx_state_forget_texture(p->tx);
+        glwrapDeleteTextures(1, &p->tx);
+    }
+
+    sys_free(layer->stamps);
+    gfx_cmdbuf_destroy(&layer->queue);
+}
+
+/* recorded now, drawn into the pages by the next gfx_decal_layer_draw */
+void gfx_decal_stamp(gfx_decal_layer_t *layer, vec2f from, vec2f to, float width, float alpha)
+{
+    if (layer->n_stamps == layer->stamps_capacity) {
+        layer->stamps_capacity = max(layer->stamps_capacity * 2, 64);
+        layer->stamps = sys_realloc(layer->stamps, layer->stamps_capacity * sizeof(gfx_decal_stamp_t));
+    }
+
+    layer->stamps[layer->n_stamps++] = (gfx_decal_stamp_t) {
+        .from = from,
+        .to = to,
+        .width = width,
+        .alpha = alpha
+    };
+}
+
+/* binds the new target */
+static void gfx_decal_create_target(gfx_decal_layer_t *layer, gfx_decal_page_t *p)
+{
+    glwrapGenTextures(1, &p->tx);
+    gfx_state_bind_texture(0, p->tx);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, layer->resolution, layer->resolution, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &p->fbo);
+    gfx_state_bind_framebuffer(p->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, p->tx, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        RENG_LOG("Decal framebuffer is incomplete");
+}
+
+/* the page covering (px, py), taking over the least recently used one if none does */
+static gfx_decal_page_t* gfx_decal_page(gfx_decal_layer_t *layer, int32_t px, int32_t py)
+{
+    gfx_decal_page_t *lru = NULL;
+    GLuint framebuffer = gfx.state.framebuffer;
+
+    for (uint32_t i = 0; i < GFX_DECAL_PAGES; i++) {
+        gfx_decal_page_t *p = &layer->pages[i];
+
+        if (p->used && p->px == px && p->py == py)
+            return p;
+
+        if (lru == NULL || (lru->used && (!p->used || p->last_used < lru->last_used)))
+            lru = p;
+    }
+
+    if (lru->used)
+        layer->n_recycled++;
+
+    if (lru->tx == 0)
+        gfx_decal_create_target(layer, lru);
+    else
+        gfx_state_bind_framebuffer(lru->fbo);
+
+    glClearColor(layer->color.r, layer->color.g, layer->color.b, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    gfx_state_bind_framebuffer(framebuffer);
+
+    lru->px = px;
+    lru->py = py;
+    lru->used = true;
+    lru->dirty = false;
+    lru->last_used = gfx.frame_index;
+    return lru;
+}
+
+/* world rect of a stamp, including its width */
+static void gfx_decal_stamp_bounds(const gfx_decal_stamp_t *s, float *x0, float *y0, float *x1, float *y1)
+{
+    float r = s->width * 0.5f;
+
+    *x0 = fminf(s->from.x, s->to.x) - r;
+    *y0 = fminf(s->from.y, s->to.y) - r;
+    *x1 = fmaxf(s->from.x, s->to.x) + r;
+    *y1 = fmaxf(s->from.y, s->to.y) + r;
+}
+
+/* unit quad along the segment, u from start to end and v across */
+static void gfx_decal_push_stamp(const gfx_decal_layer_t *layer, const gfx_decal_stamp_t *s)
+{
+    vec2f d = vec2f_diff(s->to, s->from);
+    float len = sqrtf(d.x * d.x + d.y * d.y);
+    vec2f n = len > 0.f ? VEC2F(-d.y / len * s->width, d.x / len * s->width) : VEC2F(0.f, s->width);
+    const affine2d xform = { {
+        d.x, n.x, s->from.x - n.x * 0.5f,
+        d.y, n.y, s->from.y - n.y * 0.5f
+    } };
+    rgbaf c = layer->color;
+    float a = c.a * s->alpha;
+
+    gfx_set_color(VEC4F(c.r * a, c.g * a, c.b * a, a));
+    gfx_draw_sprite(gfx.white_texture, &xform, GFX_FULL_TEXRECT);
+}
+
+/* pages that got stamps are rendered once each with every stamp touching them */
+static void gfx_decal_flush(gfx_decal_layer_t *layer)
+{
+    float scale = (float)layer->resolution / layer->size;
+
+    for (uint32_t i = 0; i < layer->n_stamps; i++) {
+        float x0, y0, x1, y1;
+        gfx_decal_stamp_bounds(&layer->stamps[i], &x0, &y0, &x1, &y1);
+
+        for (int32_t py = gfx_decal_floor_div(y0, layer->size); py <= gfx_decal_floor_div(y1, layer->size); py++)
+            for (int32_t px = gfx_decal_floor_div(x0, layer->size); px <= gfx_decal_floor_div(x1, layer->size); px++)
+                gfx_decal_page(layer, px, py)->dirty = true;
+    }
+
+    for (uint32_t i = 0; i < GFX_DECAL_PAGES; i++) {
+        gfx_decal_page_t *p = &layer->pages[i];
+        float px0 = (float)p->px * layer->size, py0 = (float)p->py * layer->size;
+        gfx_offscreen_t pass;
+        affine2d view, ndc;
+        mat4 proj;
+
+        if (!p->dirty)
+            continue;
+
+        p->dirty = false;
+        p->last_used = gfx.frame_index;
+
+        gfx_offscreen_begin(&pass, &layer->queue, p->fbo, layer->resolution, layer->resolution);
+
+        /* page rect to the whole target, y flipped like chunk cache targets */
+        affine2d_translation(&ndc, VEC2F(-1.f, -1.f));
+        affine2d_scale(&ndc, VEC2F(2.f / layer->resolution, 2.f / layer->resolution));
+        mat4_from_affine2d(&proj, &ndc);
+        affine2d_scaling(&view, VEC2F(scale, scale));
+        affine2d_translate(&view, VEC2F(-px0, -py0));
+
+        gfx_set_proj_matrix(&proj);
+        gfx_set_view_matrix(&view);
+        gfx_set_layer(GFX_LAYER_DECALS);
+        gfx_use_shader(SHADER_TINT);
+
+        for (uint32_t j = 0; j < layer->n_stamps; j++) {
+            float x0, y0, x1, y1;
+            gfx_decal_stamp_bounds(&layer->stamps[j], &x0, &y0, &x1, &y1);
+
+            if (x1 >= px0 && x0 <= px0 + layer->size && y1 >= py0 && y0 <= py0 + layer->size)
+                gfx_decal_push_stamp(layer, &layer->stamps[j]);
+        }
+
+        gfx_state_set_blend(true, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        gfx_offscreen_end(&pass);
+        gfx_state_set_blend(true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    layer->n_stamps = 0;
+}
+
+/* stamps what was recorded since the last call and records a quad per page inside the world rect */
+void gfx_decal_layer_draw(gfx_decal_layer_t *layer, float x0, float y0, float x1, float y1)
+{
+    if (layer->n_stamps)
+        gfx_decal_flush(layer);
+
+    for (uint32_t i = 0; i < GFX_DECAL_PAGES; i++) {
+        gfx_decal_page_t *p = &layer->pages[i];
+        float px0 = (float)p->px * layer->size, py0 = (float)p->py * layer->size;
+
+        if (!p->used || px0 > x1 || py0 > y1 || px0 + layer->size < x0 || py0 + layer->size < y0)
+            continue;
+
+        p->last_used = gfx.frame_index;
+        gfx_draw_2d_texture(p->tx, px0, py0, (float)layer->size, (float)layer->size);
+    }
+}
@@ -0,0 +1,121 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+
+/*
+ * Dynamic resolution. World layers render into the lower left part of an
+ * offscreen target sized like the native viewport, then get stretched over
+ * it with a linear blit before the GUI layers draw at native resolution.
+ * Changing the scale only changes the viewport, the target is reallocated
+ * when the native size changes.
+ */
+
+void gfx_dynres_enable(float target_ms)
+{
+    gfx.dynres.enabled = true;
+    gfx.dynres.target_ms = target_ms;
+    gfx.dynres.scale = 1.f;
+}
+
+void gfx_dynres_disable()
+{
+    gfx.dynres.enabled = false;
+    gfx.dynres.scale = 1.f;
+}
+
+void gfx_dynres_deinit()
+{
+    if (gfx.dynres.fbo == 0)
+        return;
+
+    glDeleteFramebuffers(1, &gfx.dynres.fbo);
+    gfx_state_forget_texture(gfx.dynres.color);
+    gfx_state_forget_texture(gfx.dynres.depth);
+    glwrapDeleteTextures(1, &gfx.dynres.color);
+    glwrapDeleteTextures(1, &gfx.dynres.depth);
+    gfx.dynres.fbo = gfx.dynres.color = gfx.dynres.depth = 0;
+    gfx.dynres.width = gfx.dynres.height = 0;
+}
+
+/*
+ * Fill cost goes with the pixel count, so the scale moves by the square
+ * root of budget over measured world GPU time, damped and in GFX_DYNRES_STEP
+ * steps so noise doesn't make it flicker.
+ */
+void gfx_dynres_update()
+{
+    float gpu_ms = gfx.prof.gpu_ms[GFX_LAYER_TILES] + gfx.prof.gpu_ms[GFX_LAYER_DECALS] + gfx.prof.gpu_ms[GFX_LAYER_ENTITIES];
+    float desired, scale;
+
+    if (!gfx.dynres.enabled || gfx.prof.n_lost || gpu_ms <= 0.f)
+        return;
+
+    desired = gfx.dynres.scale * sqrtf(gfx.dynres.target_ms / gpu_ms);
+    scale = gfx.dynres.scale + (desired - gfx.dynres.scale) * GFX_DYNRES_DAMPING;
+    scale = roundf(scale / GFX_DYNRES_STEP) * GFX_DYNRES_STEP;
+
+    gfx.dynres.scale = fminf(fmaxf(scale, GFX_DYNRES_MIN_SCALE), 1.f);
+}
+
+static void gfx_dynres_resize(GLsizei w, GLsizei h)
+{
+    gfx_dynres_deinit();
+
+    glwrapGenTextures(1, &gfx.dynres.color);
+    gfx_state_bind_texture(0, gfx.dynres.color);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glwrapGenTextures(1, &gfx.dynres.depth);
+    gfx_state_bind_texture(0, gfx.dynres.depth);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+
+    glGenFramebuffers(1, &gfx.dynres.fbo);
+    gfx_state_bind_framebuffer(gfx.dynres.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gfx.dynres.color, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gfx.dynres.depth, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        RENG_LOG("Dynamic resolution framebuffer is incomplete");
+
+    gfx.dynres.width = w;
+    gfx.dynres.height = h;
+}
+
+/* redirects drawing to the scaled target, the current target and viewport are the native ones */
+void gfx_dynres_begin_world()
+{
+    GLint *v = gfx.state.viewport;
+
+    gfx.dynres.native_fbo = gfx.state.framebuffer;
+    memcpy(gfx.dynres.native_viewport, v, sizeof(gfx.dynres.native_viewport));
+
+    if (gfx.dynres.width != v[2] || gfx.dynres.height != v[3])
+        gfx_dynres_resize(v[2], v[3]);
+    else
+        gfx_state_bind_framebuffer(gfx.dynres.fbo);
+
+    gfx.dynres.scaled_width = max((GLsizei)(v[2] * gfx.dynres.scale + 0.5f), 1);
+    gfx.dynres.scaled_height = max((GLsizei)(v[3] * gfx.dynres.scale + 0.5f), 1);
+
+    gfx_state_set_viewport(0, 0, gfx.dynres.scaled_width, gfx.dynres.scaled_height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+/* stretches the world over the native target and goes back to drawing there */
+void gfx_dynres_end_world()
+{
+    GLint *v = gfx.dynres.native_viewport;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gfx.dynres.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gfx.dynres.native_fbo);
+    glBlitFramebuffer(0, 0, gfx.dynres.scaled_width, gfx.dynres.scaled_height,
+        v[0], v[1], v[0] + v[2], v[1] + v[3], GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    /* read and draw bindings differ now, rebind both */
+    gfx.state.framebuffer = gfx.dynres.fbo;
+    gfx_state_bind_framebuffer(gfx.dynres.native_fbo);
+    gfx_state_set_viewport(v[0], v[1], v[2], v[3]);
+}
@@ -4,22 +4,14 @@
 #include "../sys.h"
 #include "../exmath.h"
 #include "../game.h"
+#include "../rwstream.h"
 
-#define STBI_MALLOC(sz)           sys_malloc(sz)
-#define STBI_REALLOC(p,newsz)     sys_realloc(p,newsz)
-#define STBI_FREE(p)              sys_free(p)
-#define STB_IMAGE_IMPLEMENTATION
-#include "..\other\stb_image.h"
+#include <stddef.h>
 
 #define GL_EXT_MACRO(x, caps) PFN##caps##PROC x;
 #include "..\gl_extensions.h"
 
-typedef struct asset {
-    textureid_t tx;
-} asset_t;
-
-shader_t shader;
-hashtable_t assets;
+gfx_common_t gfx;
 
 void font_create(font_t* f, textureid_t tx, int start_letter, int row_len, int col_len, vec3f letter_size)
 {
@@ -31,105 +23,370 @@ void font_create(font_t* f, textureid_t tx, int start_letter, int row_len, int c
     f->letter_size = letter_size;
     f->col_len = col_len;
 
-    mat4_scaling(&f->modelmat, letter_size);
-    mat4_scaling(&f->texmat, VEC3F(1.f / f->row_len, 1.f / f->col_len, 1.f));
+    f->uvsize = VEC2F(1.f / f->row_len, 1.f / f->col_len);
 }
 
-void gfx_do_opengl_stuff() {
-    static const char* vertex_src =
-        "#version 330 core\n"
-        "layout (location = 0) in vec3 aPos;\n"
-        "layout (location = 1) in vec2 aTexCoord;\n"
-        "layout (location = 2) in vec4 vColor;\n"
-        "uniform mat4 modelMat;\n"
-        "uniform mat4 viewMat;\n"
-        "uniform mat4 projMat;\n"
-        "uniform vec4 u_color;\n"
-        "out vec4 f_color;\n"
-        "out vec2 TexCoord;\n"
-        "out vec4 color;\n"
-        "void main()\n"
-        "{\n"
-        "    gl_Position = projMat * viewMat * modelMat * vec4(aPos, 1);\n"
-        "    f_color = u_color * vColor;\n"
-        "    TexCoord = aTexCoord;\n"
-        "}\n";
-    
-    static const char* frag_src =
-        "#version 330 core\n"
-        "out vec4 FragColor;\n"
-        "uniform mat4 texTransformMat;\n"
-        "uniform sampler2D tex;\n"
-        "in vec4 f_color;\n"
-        "in vec2 TexCoord;\n"
-        "void main()\n"
-        "{\n"
-        "    vec4 col = texture(tex, (texTransformMat * vec4(TexCoord, 0.f, 1.f)).xy);\n"
-        "    if (col.a < 0.1) discard;\n"
-        "    else FragColor = f_color * col;\n"
-        "}\n";
-    
-    GLuint vertex, frag;
-    GLint success;
+/*
+ * Every shader is built from the same source with a few SHADER_* switches
+ * prepended, all variants are compiled once in gfx_init.
+ * Sprites are instanced: transform (with view baked in), uv rect and tint come from gfx_instance_t,
+ * uv rect is applied per vertex, fragment stage only samples.
+ */
+static const char* vertex_src =
+    "layout (location = 0) in vec3 aPos;\n"
+    "layout (location = 1) in vec2 aTexCoord;\n"
+    "layout (location = 3) in vec3 iXformX;\n"
+    "layout (location = 4) in vec3 iXformY;\n"
+    "layout (location = 5) in vec4 iTexRect;\n"
+    "layout (location = 6) in vec4 iTint;\n"
+    "uniform mat4 projMat;\n"
+    "#if SHADER_TINT\n"
+    "out vec4 f_color;\n"
+    "#endif\n"
+    "out vec2 TexCoord;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 p = vec3(aPos.xy, 1);\n"
+    "    gl_Position = projMat * vec4(dot(iXformX, p), dot(iXformY, p), 0, 1);\n"
+    "#if SHADER_TINT\n"
+    "    f_color = iTint;\n"
+    "#endif\n"
+    "    TexCoord = iTexRect.xy + aTexCoord * iTexRect.zw;\n"
+    "}\n";
+
+static const char* frag_src =
+    "out vec4 FragColor;\n"
+    "uniform sampler2D tex;\n"
+    "#if SHADER_TINT\n"
+    "in vec4 f_color;\n"
+    "#endif\n"
+    "in vec2 TexCoord;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 col = texture(tex, TexCoord);\n"
+    "#if SHADER_ALPHA_DISCARD\n"
+    "    if (col.a < 0.1) discard;\n"
+    "#endif\n"
+    "#if SHADER_TINT\n"
+    "    col *= f_color;\n"
+    "#endif\n"
+    "    FragColor = col;\n"
+    "}\n";
+
+/* meshes, see gfx_draw_geometry: prelit vertex color times material color times texture */
+static const char* mesh_vertex_src =
+    "layout (location = 0) in vec3 aPos;\n"
+    "layout (location = 1) in vec2 aTexCoord;\n"
+    "layout (location = 2) in vec4 aColor;\n"
+    "uniform mat4 mvp;\n"
+    "uniform vec4 matColor;\n"
+    "out vec4 f_color;\n"
+    "out vec2 TexCoord;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = mvp * vec4(aPos, 1);\n"
+    "    f_color = aColor * matColor;\n"
+    "    TexCoord = aTexCoord;\n"
+    "}\n";
+
+static const char* mesh_frag_src =
+    "out vec4 FragColor;\n"
+    "uniform sampler2D tex;\n"
+    "in vec4 f_color;\n"
+    "in vec2 TexCoord;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 col = texture(tex, TexCoord) * f_color;\n"
+    "    if (col.a < 0.1) discard;\n"
+    "    FragColor = col;\n"
+    "}\n";
+
+GLuint gfx_compile_stage(GLenum type, const char *defines, const char *src)
+{
     static char infoLog[512];
+    const char *strings[3] = { "#version 330 core\n", defines, src };
+    GLuint stage;
+    GLint success;
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS); 
+    stage = glCreateShader(type);
+    glShaderSource(stage, 3, strings, NULL);
+    glCompileShader(stage);
 
-    #define GL_EXT_MACRO(x, caps) x = (PFN##caps##PROC)wglGetProcAddress(#x); if (x == NULL) printf("%s = %p\n", #x, x);
-    #include "..\gl_extensions.h"
+    glGetShaderiv(stage, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(stage, 512, NULL, infoLog);
+        printf("%s shader error: %s\n", (type == GL_VERTEX_SHADER) ? "Vertex" : "Fragment", infoLog);
+    }
 
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vertex_src, NULL);
-    glCompileShader(vertex);
+    return stage;
+}
 
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        printf("Vertex shader error: %s\n", infoLog);
+void gfx_compile_shader(shader_t *sh, uint32_t variant)
+{
+    char defines[128];
+    GLuint vertex, frag;
+
+    snprintf(defines, sizeof(defines),
+        "#define SHADER_TINT %d\n"
+        "#define SHADER_ALPHA_DISCARD %d\n",
+        (variant & SHADER_TINT) != 0,
+        (variant & SHADER_ALPHA_DISCARD) != 0
+    );
+
+    vertex = gfx_compile_stage(GL_VERTEX_SHADER, defines, vertex_src);
+    frag = gfx_compile_stage(GL_FRAGMENT_SHADER, defines, frag_src);
+
+    sh->program = glCreateProgram();
+    glAttachShader(sh->program, vertex);
+    glAttachShader(sh->program, frag);
+    glLinkProgram(sh->program);
+
+    sh->proj_mat_location       = glGetUniformLocation(sh->program, "projMat");
+    sh->uniforms_valid          = false;
+
+    glDeleteShader(vertex);
+    glDeleteShader(frag);
+}
+
+void gfx_compile_mesh_shader(mesh_shader_t *sh)
+{
+    GLuint vertex, frag;
+
+    vertex = gfx_compile_stage(GL_VERTEX_SHADER, "", mesh_vertex_src);
+    frag = gfx_compile_stage(GL_FRAGMENT_SHADER, "", mesh_frag_src);
+
+    sh->program = glCreateProgram();
+    glAttachShader(sh->program, vertex);
+    glAttachShader(sh->program, frag);
+    glLinkProgram(sh->program);
+
+    sh->mvp_location            = glGetUniformLocation(sh->program, "mvp");
+    sh->color_location          = glGetUniformLocation(sh->program, "matColor");
+
+    glDeleteShader(vertex);
+    glDeleteShader(frag);
+}
+
+/* ************** *
+ * GL STATE CACHE *
+ * ************** */
+
+#define GFX_STATE_UNKNOWN 0xFFFFFFFF
+
+static inline bool gfx_state_changed(bool changed)
+{
+    if (changed) gfx.state.frame.issued++;
+    else gfx.state.frame.skipped++;
+
+    return changed;
+}
+
+/* forgets everything, next call of each kind goes to GL. Render target and viewport are read back, callers restore them */
+void gfx_state_invalidate()
+{
+    GLint framebuffer;
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv(GL_VIEWPORT, gfx.state.viewport);
+    gfx.state.framebuffer = framebuffer;
+
+    gfx.state.program = GFX_STATE_UNKNOWN;
+    gfx.state.vao = GFX_STATE_UNKNOWN;
+    gfx.state.array_buffer = GFX_STATE_UNKNOWN;
+    gfx.state.active_unit = GFX_STATE_UNKNOWN;
+    for (uint32_t i = 0; i < GFX_TEXTURE_UNITS; i++)
+        gfx.state.textures[i] = GFX_STATE_UNKNOWN;
+
+    gfx.state.blend = GFX_STATE_UNKNOWN;
+    gfx.state.blend_src = gfx.state.blend_dst = GFX_STATE_UNKNOWN;
+    gfx.state.depth_test = GFX_STATE_UNKNOWN;
+    gfx.state.depth_func = GFX_STATE_UNKNOWN;
+
+    for (uint32_t i = 0; i < SHADER_VARIANT_COUNT; i++)
+        gfx.shaders[i].uniforms_valid = false;
+}
+
+void gfx_state_use_program(GLuint program)
+{
+    if (gfx_state_changed(gfx.state.program != program)) {
+        gfx.state.program = program;
+        glUseProgram(program);
+    }
+}
+
+void gfx_state_bind_vao(GLuint vao)
+{
+    if (gfx_state_changed(gfx.state.vao != vao)) {
+        gfx.state.vao = vao;
+        glBindVertexArray(vao);
     }
+}
 
-    frag = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(frag, 1, &frag_src, NULL);
-    glCompileShader(frag); 
+void gfx_state_bind_array_buffer(GLuint buffer)
+{
+    if (gfx_state_changed(gfx.state.array_buffer != buffer)) {
+        gfx.state.array_buffer = buffer;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    }
+}
 
-    glGetShaderiv(frag, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(frag, 512, NULL, infoLog);
-        printf("Fragment shader error: %s\n", infoLog);
+void gfx_state_bind_framebuffer(GLuint fbo)
+{
+    if (gfx_state_changed(gfx.state.framebuffer != fbo)) {
+        gfx.state.framebuffer = fbo;
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
     }
+}
 
-    shader.program = glCreateProgram();
-    glAttachShader(shader.program, vertex);
-    glAttachShader(shader.program, frag);
-    glLinkProgram(shader.program);
-    glUseProgram(shader.program);
+void gfx_state_set_viewport(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+    GLint *v = gfx.state.viewport;
 
-    shader.model_mat_location           = glGetUniformLocation(shader.program, "modelMat");
-    shader.view_mat_location            = glGetUniformLocation(shader.program, "viewMat");
-    shader.proj_mat_location            = glGetUniformLocation(shader.program, "projMat");
-    shader.color_location               = glGetUniformLocation(shader.program, "u_color");
-    shader.textransform_mat_location    = glGetUniformLocation(shader.program, "texTransformMat");
+    if (gfx_state_changed(v[0] != x || v[1] != y || v[2] != w || v[3] != h)) {
+        v[0] = x; v[1] = y; v[2] = w; v[3] = h;
+        glViewport(x, y, w, h);
+    }
+}
 
-    glDeleteShader(vertex);
-    glDeleteShader(frag); 
+void gfx_state_bind_texture(uint32_t unit, textureid_t tx)
+{
+    if (!gfx_state_changed(gfx.state.textures[unit] != tx))
+        return;
+
+    if (gfx_state_changed(gfx.state.active_unit != unit)) {
+        gfx.state.active_unit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    gfx.state.textures[unit] = tx;
+    glBindTexture(GL_TEXTURE_2D, tx);
+}
+
+/* GL unbinds deleted objects by itself and may hand out the same name again, keep the cache in sync */
+void gfx_state_forget_texture(textureid_t tx)
+{
+    for (uint32_t i = 0; i < GFX_TEXTURE_UNITS; i++)
+        if (gfx.state.textures[i] == tx) gfx.state.textures[i] = GFX_STATE_UNKNOWN;
+}
+
+void gfx_state_forget_buffer(GLuint buffer)
+{
+    if (gfx.state.array_buffer == buffer) gfx.state.array_buffer = GFX_STATE_UNKNOWN;
+}
 
-    glvertex_t quad_vertices[5] = {
+void gfx_state_forget_vao(GLuint vao)
+{
+    if (gfx.state.vao == vao) gfx.state.vao = GFX_STATE_UNKNOWN;
+}
+
+void gfx_state_set_blend(bool enable, GLenum src, GLenum dst)
+{
+    if (gfx_state_changed(gfx.state.blend != enable)) {
+        gfx.state.blend = enable;
+        if (enable) glEnable(GL_BLEND);
+        else glDisable(GL_BLEND);
+    }
+
+    if (enable && gfx_state_changed(gfx.state.blend_src != src || gfx.state.blend_dst != dst)) {
+        gfx.state.blend_src = src;
+        gfx.state.blend_dst = dst;
+        glBlendFunc(src, dst);
+    }
+}
+
+void gfx_state_set_depth(bool enable, GLenum func)
+{
+    if (gfx_state_changed(gfx.state.depth_test != enable)) {
+        gfx.state.depth_test = enable;
+        if (enable) glEnable(GL_DEPTH_TEST);
+        else glDisable(GL_DEPTH_TEST);
+    }
+
+    if (enable && gfx_state_changed(gfx.state.depth_func != func)) {
+        gfx.state.depth_func = func;
+        glDepthFunc(func);
+    }
+}
+
+/* uploads m to the bound program unless cache already holds the same value */
+void gfx_state_uniform_mat4(GLint location, mat4 *cache, bool cache_valid, const mat4 *m)
+{
+    if (gfx_state_changed(!cache_valid || memcmp(cache->v, m->v, sizeof(m->v)) != 0)) {
+        *cache = *m;
+        glUniformMatrix4fv(location, 1, GL_TRUE, m->v);
+    }
+}
+
+void gfx_begin_frame()
+{
+    gfx.state.last_frame = gfx.state.frame;
+    gfx.state.frame = (gfx_state_stats_t) { 0 };
+    gfx.frame_index++;
+
+    gfx_prof_begin_frame();
+    gfx_dynres_update();
+
+    gfx_stream_update(GFX_STREAM_BUDGET_USEC);
+}
+
+void gfx_end_frame()
+{
+    gfx.dynres.submitting = true;
+    gfx_submit();
+    gfx.dynres.submitting = false;
+
+    gfx_residency_collect();
+}
+
+/* instance attributes of quad_vao read instance_vbo from offset, call with both bound */
+static void gfx_point_instance_attribs(size_t offset)
+{
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(gfx_instance_t), (void*)(offset + offsetof(gfx_instance_t, xform.v[0])));
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(gfx_instance_t), (void*)(offset + offsetof(gfx_instance_t, xform.v[3])));
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(gfx_instance_t), (void*)(offset + offsetof(gfx_instance_t, texrect)));
+    glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(gfx_instance_t), (void*)(offset + offsetof(gfx_instance_t, tint)));
+}
+
+void gfx_do_opengl_stuff() {
+    #define GL_EXT_MACRO(x, caps) x = (PFN##caps##PROC)wglGetProcAddress(#x); if (x == NULL) printf("%s = %p\n", #x, x);
+    #include "..\gl_extensions.h"
+
+    gfx_state_invalidate();
+    gfx_state_set_blend(true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gfx_state_set_depth(true, GL_LESS);
+
+    for (uint32_t i = 0; i < SHADER_VARIANT_COUNT; i++)
+        gfx_compile_shader(&gfx.shaders[i], i);
+    gfx_compile_mesh_shader(&gfx.mesh_shader);
+
+    gfx.view = (affine2d)AFFINE2D_IDENTITY;
+    gfx.proj = (mat4)MAT4_IDENTITY;
+    gfx_set_color(VEC4F(1.f, 1.f, 1.f, 1.f));
+
+    gfx.shader = &gfx.shaders[0];
+    gfx_state_use_program(gfx.shader->program);
+
+    gfx.variant = 0;
+    gfx.layer = GFX_LAYER_TILES;
+    gfx.depth = 0;
+    gfx_cmdbuf_create(&gfx.queue);
+
+    glvertex_t quad_vertices[4] = {
         { .pos = { 0.f, 0.f, 0.f }, .uv = { 0.f, 0.f }, .color = { 1.f, 1.f, 1.f, 1.f } },
         { .pos = { 1.f, 0.f, 0.f }, .uv = { 1.f, 0.f }, .color = { 1.f, 1.f, 1.f, 1.f } },
         { .pos = { 1.f, 1.f, 0.f }, .uv = { 1.f, 1.f }, .color = { 1.f, 1.f, 1.f, 1.f } },
-        { .pos = { 0.f, 1.f, 0.f }, .uv = { 0.f, 1.f }, .color = { 1.f, 1.f, 1.f, 1.f } },
-        { .pos = { 0.f, 0.f, 0.f }, .uv = { 0.f, 1.f }, .color = { 1.f, 1.f, 1.f, 1.f } }
+        { .pos = { 0.f, 1.f, 0.f }, .uv = { 0.f, 1.f }, .color = { 1.f, 1.f, 1.f, 1.f } }
     };
 
-    glwrapGenBuffers(1, &shader.quad_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, shader.quad_vbo);
+    /* two triangles per quad, core profile has no GL_QUADS */
+    static const GLubyte quad_indices[6] = { 0, 1, 2,   2, 3, 0 };
+
+    glwrapGenBuffers(1, &gfx.quad_vbo);
+    gfx_state_bind_array_buffer(gfx.quad_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
 
-    glwrapGenVertexArrays(1, &shader.quad_vao);
-    glBindVertexArray(shader.quad_vao);
+    glwrapGenVertexArrays(1, &gfx.quad_vao);
+    gfx_state_bind_vao(gfx.quad_vao);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glvertex_t), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glvertex_t), (void*)(3 * sizeof(float)));
@@ -137,8 +394,31 @@ void gfx_do_opengl_stuff() {
     glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glvertex_t), (void*)(5 * sizeof(float)));
     glEnableVertexAttribArray(2);
 
-    glwrapGenTextures(1, &shader.white_texture);
-    glBindTexture(GL_TEXTURE_2D, shader.white_texture);
+    /* per-instance attributes, streamed by gfx_draw_instances */
+    glwrapGenBuffers(1, &gfx.instance_vbo);
+    gfx_state_bind_array_buffer(gfx.instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, GFX_INSTANCE_RING * sizeof(gfx_instance_t), NULL, GL_STREAM_DRAW);
+    gfx.instance_capacity = GFX_INSTANCE_RING;
+    gfx.instance_head = 0;
+
+    gfx_point_instance_attribs(0);
+
+    for (GLuint i = 3; i <= 6; i++) {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1);
+    }
+
+    gfx.batch = sys_malloc(GFX_MAX_INSTANCES * sizeof(gfx_instance_t));
+    gfx.batch_size = 0;
+    gfx.batch_tx = 0;
+
+    /* element buffer binding is part of the VAO state */
+    glwrapGenBuffers(1, &gfx.quad_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gfx.quad_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
+
+    glwrapGenTextures(1, &gfx.white_texture);
+    gfx_state_bind_texture(0, gfx.white_texture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -148,10 +428,6 @@ void gfx_do_opengl_stuff() {
     static uint8_t white_data[4] = { 255, 255, 255, 255 };
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white_data);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0); 
-    glBindVertexArray(0);
 }
 
 vec2f font_measure_text(font_t* f, const char* text)
@@ -178,107 +454,257 @@ vec2f font_measure_text(font_t* f, const char* text)
 void gfx_init()
 {
     gfx_do_opengl_stuff();
-    assets = hashtable_of(asset_t);
+    gfx_prof_init();
+    gfx_particles_init();
+    gfx_residency_init();
+    gfx_stream_init();
 }
 
 void gfx_deinit()
 {
-    glwrapDeleteBuffers(1, &shader.quad_vao);
-    glwrapDeleteVertexArrays(1, &shader.quad_vbo);
+    gfx_stream_deinit();
+    gfx_prof_deinit();
+    gfx_dynres_deinit();
+    gfx_particles_deinit();
+
+    glwrapDeleteBuffers(1, &gfx.quad_vbo);
+    glwrapDeleteBuffers(1, &gfx.quad_ebo);
+    glwrapDeleteBuffers(1, &gfx.instance_vbo);
+    glwrapDeleteVertexArrays(1, &gfx.quad_vao);
+    sys_free(gfx.batch);
+    gfx_cmdbuf_destroy(&gfx.queue);
+    sys_free(gfx.sort_items);
+    sys_free(gfx.sort_tmp);
+
+    gfx_residency_deinit();
+
+    for (uint32_t i = 0; i < SHADER_VARIANT_COUNT; i++)
+        glDeleteProgram(gfx.shaders[i].program);
+    glDeleteProgram(gfx.mesh_shader.program);
+}
 
-	for (int i = 0; i < assets.n_buckets * HT_SECTION_LEN; i++) {
-		if (hashtable_pick_bucket(&assets, i)->used)
-            glwrapDeleteTextures(1, &HASHBUCKET_DATA(hashtable_pick_bucket(&assets, i), asset_t).tx);
-    }
+void gfx_use_shader(uint32_t variant)
+{
+    gfx.variant = variant;
+}
 
-    glDeleteProgram(shader.program);
-    hashtable_destroy(&assets);
+void gfx_set_layer(gfx_layer_t layer)
+{
+    gfx.layer = layer;
 }
 
-void gfx_draw_2d_texture(textureid_t tx, float x, float y, float sx, float sy) {
-    mat4 ident = MAT4_IDENTITY;
-    mat4 modelmat;
+/* ordering inside a layer, lower is drawn first */
+void gfx_set_depth(uint16_t depth)
+{
+    gfx.depth = depth;
+}
 
-    mat4_translation(&modelmat, VEC3F(x, y, 0.f));
-    mat4_scale(&modelmat, VEC3F(sx, sy, 1));
+/* baked into each pushed sprite */
+void gfx_set_view_matrix(const affine2d *view)
+{
+    gfx.view = *view;
+}
 
-    glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, modelmat.v);
-    glUniformMatrix4fv(shader.textransform_mat_location, 1, GL_TRUE, ident.v);
+void gfx_set_proj_matrix(mat4 *proj)
+{
+    gfx.proj = *proj;
+}
 
-    glBindTexture(GL_TEXTURE_2D, tx);
-    glBindVertexArray(shader.quad_vao);
-    glDrawArrays(GL_QUADS, 0, 4);
+/* tint of the sprites pushed after this call, only SHADER_TINT variants use it */
+void gfx_set_color(rgbaf color)
+{
+    gfx.color = color;
+    gfx.tint[0] = (uint8_t)(fminf(fmaxf(color.r, 0.f), 1.f) * 255.f + 0.5f);
+    gfx.tint[1] = (uint8_t)(fminf(fmaxf(color.g, 0.f), 1.f) * 255.f + 0.5f);
+    gfx.tint[2] = (uint8_t)(fminf(fmaxf(color.b, 0.f), 1.f) * 255.f + 0.5f);
+    gfx.tint[3] = (uint8_t)(fminf(fmaxf(color.a, 0.f), 1.f) * 255.f + 0.5f);
 }
 
-void gfx_draw_2d_texture_rect(textureid_t tx, float x, float y, float sx, float sy, float txx, float txy, float txscalex, float txscaley) {
-    mat4 modelmat;
-    mat4 texmat;
-    
-    mat4_translation(&modelmat, VEC3F(x, y, 0));
-    mat4_scale(&modelmat, VEC3F(sx, sy, 1));
-    mat4_translation(&texmat, VEC3F(txx, txy, 0.f));
-    mat4_scale(&texmat, VEC3F(txscalex, txscaley, 1.f));
+/* binds the current variant, projection is shared by all variants and uploaded lazily */
+void gfx_flush_globals()
+{
+    shader_t *sh = gfx.shader;
 
-    glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, modelmat.v);
-    glUniformMatrix4fv(shader.textransform_mat_location, 1, GL_TRUE, texmat.v);
+    gfx_state_use_program(sh->program);
+    gfx_state_uniform_mat4(sh->proj_mat_location, &sh->proj, sh->uniforms_valid, &gfx.proj);
+    sh->uniforms_valid = true;
+}
 
-    glBindTexture(GL_TEXTURE_2D, tx);
-    glBindVertexArray(shader.quad_vao);
-    glDrawArrays(GL_QUADS, 0, 4);
+/*
+ * One instanced draw with the current shader. Instances are appended to a
+ * ring in instance_vbo without waiting on earlier draws, the storage is only
+ * orphaned when the ring wraps or a batch is bigger than the whole buffer.
+ */
+void gfx_draw_instances(textureid_t tx, const gfx_instance_t *instances, uint32_t n)
+{
+    size_t offset, bytes = n * sizeof(gfx_instance_t);
+    void *dst;
+
+    if (n == 0)
+        return;
+
+    gfx_flush_globals();
+
+    gfx_state_bind_texture(0, tx);
+    gfx_state_bind_vao(gfx.quad_vao);
+    gfx_state_bind_array_buffer(gfx.instance_vbo);
+
+    if (gfx.instance_head + n > gfx.instance_capacity) {
+        gfx.instance_capacity = max(gfx.instance_capacity, n);
+        gfx.instance_head = 0;
+        glBufferData(GL_ARRAY_BUFFER, gfx.instance_capacity * sizeof(gfx_instance_t), NULL, GL_STREAM_DRAW);
+    }
+
+    /* draws in flight only read before the head, nothing to wait for */
+    offset = gfx.instance_head * sizeof(gfx_instance_t);
+    dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst != NULL) {
+        memcpy(dst, instances, bytes);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, instances);
+    }
+
+    /* core 3.3 has no base instance, the attributes are pointed at this draw's slice instead */
+    gfx_point_instance_attribs(offset);
+    gfx.instance_head += n;
+
+    glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, (void*)0, n);
+    gfx.state.frame.draw_calls++;
+    gfx.state.frame.vertices += 6 * n;
 }
 
-unsigned int gfx_cache_texture(char *name, unsigned int filter)
+/* submits pending sprites as one instanced draw */
+void gfx_flush()
 {
-    textureid_t tx;
-    hashbucket_t *find = hashtable_find(&assets, name);
+    if (gfx.batch_size == 0)
+        return;
 
-    if (find != NULL)
-        return HASHBUCKET_DATA(find, asset_t).tx;
+    gfx_draw_instances(gfx.batch_tx, gfx.batch, gfx.batch_size);
+    gfx.batch_size = 0;
+}
 
-    tx = gfx_load_texture(name, filter);
-    if (tx != 0)
-        HASHBUCKET_DATA(hashtable_emplace(&assets, name), asset_t).tx = tx;
-    
-	return tx;
+/* xform maps the unit quad to the world, the sprite is recorded into the frame queue */
+void gfx_draw_sprite(textureid_t tx, const affine2d *xform, vec4f texrect)
+{
+    gfx_cmd_t *cmd = gfx_cmdbuf_push(&gfx.queue);
+    gfx_instance_t *inst = &cmd->inst;
+
+    cmd->key = gfx_make_sort_key(gfx.layer, gfx.variant, tx, gfx.depth);
+    cmd->tx = tx;
+    cmd->variant = gfx.variant;
+    cmd->n_instances = 0;
+
+    affine2d_mul(&inst->xform, &gfx.view, xform);
+    inst->texrect[0] = texrect.x;
+    inst->texrect[1] = texrect.y;
+    inst->texrect[2] = texrect.z;
+    inst->texrect[3] = texrect.w;
+    memcpy(inst->tint, gfx.tint, sizeof(inst->tint));
 }
 
-void gfx_uncache_texture(char *name)
+/* a prebuilt batch drawn as is, view must already be applied to every xform */
+void gfx_push_instances(textureid_t tx, const gfx_instance_t *instances, uint32_t n)
 {
-    hashbucket_t* find = hashtable_find(&assets, name);
-	if (find == NULL)
+    gfx_cmd_t *cmd;
+
+    if (n == 0)
         return;
 
-    glwrapDeleteTextures(1, &HASHBUCKET_DATA(find, asset_t).tx);
-    hashbucket_empty(find);
+    cmd = gfx_cmdbuf_push(&gfx.queue);
+    cmd->key = gfx_make_sort_key(gfx.layer, gfx.variant, tx, gfx.depth);
+    cmd->tx = tx;
+    cmd->variant = gfx.variant;
+    cmd->n_instances = n;
+    cmd->instances = instances;
 }
 
-unsigned int gfx_load_texture(char *path, unsigned int filter)
+/*
+ * Draws now with the current depth state. The vao carries the geometry's one
+ * vertex and element buffer, each texture sorted run is a single multi-draw.
+ */
+void gfx_draw_geometry(const geometry_t *g, const mat4 *mvp)
 {
-    GLuint texture = 0;
-    uint32_t width, height, nrChannels;
+    mesh_shader_t *sh = &gfx.mesh_shader;
+
+    gfx_state_use_program(sh->program);
+    glUniformMatrix4fv(sh->mvp_location, 1, GL_TRUE, mvp->v);
+    gfx_state_bind_vao(g->vao);
+
+    for (size_t i = 0; i < g->n_draws; i++) {
+        const drawcall_t *dc = &g->draws[i];
+        const material_t *mat = &g->materials[dc->material];
+
+        gfx_state_bind_texture(0, mat->tx[0] ? mat->tx[0] : gfx.white_texture);
+        glUniform4f(sh->color_location,
+            (mat->color & 0xFF) / 255.f, ((mat->color >> 8) & 0xFF) / 255.f,
+            ((mat->color >> 16) & 0xFF) / 255.f, ((mat->color >> 24) & 0xFF) / 255.f);
+
+        glMultiDrawElements(GL_TRIANGLES, g->range_counts + dc->first, GL_UNSIGNED_SHORT,
+            g->range_offsets + dc->first, dc->n_ranges);
+    }
+
+    gfx.state.frame.draw_calls += (uint32_t)g->n_draws;
+    gfx.state.frame.vertices += 3 * (uint32_t)g->n_triangles;
+}
+
+/* records g into the current layer, mvp is read at gfx_submit */
+void gfx_push_geometry(const geometry_t *g, const mat4 *mvp)
+{
+    gfx_cmd_t *cmd = gfx_cmdbuf_push(&gfx.queue);
+
+    cmd->key = gfx_make_sort_key(gfx.layer, GFX_VARIANT_MESH, 0, gfx.depth);
+    cmd->tx = 0;
+    cmd->variant = GFX_VARIANT_MESH;
+    cmd->n_instances = 0;
+    cmd->mesh.geometry = g;
+    cmd->mesh.mvp = mvp;
+}
+
+void gfx_draw_2d_texture(textureid_t tx, float x, float y, float sx, float sy) {
+    gfx_draw_2d_texture_rect(tx, x, y, sx, sy, 0.f, 0.f, 1.f, 1.f);
+}
+
+void gfx_draw_2d_texture_rect(textureid_t tx, float x, float y, float sx, float sy, float txx, float txy, float txscalex, float txscaley) {
+    const affine2d xform = { {
+        sx,  0.f, x,
+        0.f, sy,  y
+    } };
+
+    gfx_draw_sprite(tx, &xform, VEC4F(txx, txy, txscalex, txscaley));
+}
 
-    unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 4);
+/* wrap and filter of the texture bound to unit 0 */
+void gfx_set_texture_params(unsigned int filter)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     
-    if (data) {
+    if (filter == TEXTURE_LINEAR_FILTER) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);    
+    }
+}
+
+/* bytes gets the size of every level, it can be NULL */
+unsigned int gfx_load_texture(char *path, unsigned int filter, size_t *bytes)
+{
+    GLuint texture = 0;
+    gfx_cooked_texture_t ct;
+
+    if (gfx_cooked_open(path, &ct)) {
         glwrapGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        
-        if (filter == TEXTURE_LINEAR_FILTER) {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        }
-        else {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);    
-        }
-    
-        glTexImage2D(GL_TEXTURE_2D, 0, nrChannels == 3 ? GL_RGB : GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        sys_free(data);
+        gfx_state_bind_texture(0, texture);
+        gfx_set_texture_params(filter);
+
+        gfx_cooked_upload(&ct);
+        if (bytes) *bytes = gfx_cooked_bytes(&ct);
+        gfx_cooked_close(&ct);
     }
 
     return texture;
@@ -286,43 +712,40 @@ unsigned int gfx_load_texture(char *path, unsigned int filter)
 
 void gfx_setup_xy_screen_matrices()
 {
-    mat4 ident = MAT4_IDENTITY;
+    affine2d ident = AFFINE2D_IDENTITY;
+    affine2d screen;
     mat4 projmat;
 
-    mat4_translation(&projmat, VEC3F(-1.f, 1.f, 0.f));
-    mat4_scale(&projmat, VEC3F(2.f / sys.width, -2.f / sys.height, 1.f));
+    affine2d_translation(&screen, VEC2F(-1.f, 1.f));
+    affine2d_scale(&screen, VEC2F(2.f / sys.width, -2.f / sys.height));
+    mat4_from_affine2d(&projmat, &screen);
 
-    glUniform4f(shader.color_location, 1.f, 1.f, 1.f, 1.f);
-    glUniformMatrix4fv(shader.view_mat_location, 1, GL_TRUE, ident.v);
-    glUniformMatrix4fv(shader.proj_mat_location, 1, GL_TRUE, projmat.v);
+    gfx_set_color(VEC4F(1.f, 1.f, 1.f, 1.f));
+    gfx_set_view_matrix(&ident);
+    gfx_set_proj_matrix(&projmat);
 }
 
 void gfx_draw_text(char *str, font_t *font, vec3f pos, vec3f color)
 {
     vec3f curpos = pos;
+    gfx_layer_t layer = gfx.layer;
+    uint32_t variant = gfx.variant;
+    rgbaf prev_color = gfx.color;
 
     int xs = (int)font->letter_size.x + 2;
     int ys = (int)font->letter_size.y + 2;
 
-    glBindTexture(GL_TEXTURE_2D, font->tx);
-    glBindVertexArray(shader.quad_vao);
-    glUniform4f(shader.color_location, color.x, color.y, color.z, 1.f);
+    gfx_set_layer(GFX_LAYER_TEXT);
+    gfx_use_shader(SHADER_TINT | SHADER_ALPHA_DISCARD);
+    gfx_set_color(VEC4F(color.x, color.y, color.z, 1.f));
 
     while(*str) {
         int c = *str - font->start_letter;
         int x = c % font->row_len;
         int y = c / font->row_len;
 
-        mat4 modelmat, texmat, tmpmat;
-        mat4_translation(&tmpmat, curpos);
-        mat4_mul(&modelmat, &tmpmat, &font->modelmat);
-        mat4_translation(&tmpmat,   VEC3F((float)x / font->row_len, (float)y / font->col_len, 0.f));
-        mat4_mul(&texmat, &tmpmat, &font->texmat);
-        
-        glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, modelmat.v);
-        glUniformMatrix4fv(shader.textransform_mat_location, 1, GL_TRUE, texmat.v);
-
-        glDrawArrays(GL_QUADS, 0, 4);
+        gfx_draw_2d_texture_rect(font->tx, curpos.x, curpos.y, font->letter_size.x, font->letter_size.y,
+            x * font->uvsize.x, y * font->uvsize.y, font->uvsize.x, font->uvsize.y);
 
         if (*str == '\n') {
             curpos.x = pos.x;
@@ -336,6 +759,8 @@ void gfx_draw_text(char *str, font_t *font, vec3f pos, vec3f color)
         str++;
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glUniform4f(shader.color_location, 1.f, 1.f, 1.f, 1.f);
+    /* whatever the caller records next must not pick up the text state */
+    gfx_set_color(prev_color);
+    gfx_use_shader(variant);
+    gfx_set_layer(layer);
 }
\ No newline at end of file
@@ -26,16 +26,14 @@ void gui_window_calcdim(gui_window_t* win)
 
 void gui_window_draw(gui_window_t* win, gui_context_t* ctx)
 {
-	glBindTexture(GL_TEXTURE_2D, shader.white_texture);
-	glBindVertexArray(shader.quad_vao);
-	glUniform4f(shader.color_location, 0.f, 0.f, 0.f, 0.2f);
+	gfx_use_shader(SHADER_TINT);
+	gfx_set_color(VEC4F(0.f, 0.f, 0.f, 0.2f));
 
-	mat4 model;
-	mat4_translation(&model, VEC3F(ctx->pos.x + win->base.position.x, ctx->pos.y + win->base.position.y, 0.f));
-	mat4_scale(&model, VEC3F(win->base.size.x, win->base.size.y, 1.f));
+	affine2d model;
+	affine2d_translation(&model, VEC2F(ctx->pos.x + win->base.position.x, ctx->pos.y + win->base.position.y));
+	affine2d_scale(&model, win->base.size);
 
-	glUniformMatrix4fv(shader.model_mat_location, 1, GL_TRUE, model.v);
-	glDrawArrays(GL_QUADS, 0, 4);
+	gfx_draw_sprite(gfx.white_texture, &model, GFX_FULL_TEXRECT);
 
 	vec2f_add(&ctx->pos, win->base.child_position);
 
@@ -0,0 +1,191 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+#include "../exmath.h"
+
+#include "../simd.h"
+
+/*
+ * Particle emitters. Attributes live in separate arrays and are updated
+ * four particles at a time with simd4f, dead ones are swapped out afterwards.
+ * Drawing builds one instance per particle and records the whole emitter
+ * as a single command, so it costs one instanced draw per texture.
+ */
+
+#define GFX_PUFF_SIZE 32
+
+/* white, alpha falls off smoothly towards the edge */
+void gfx_particles_init()
+{
+    static uint8_t pixels[GFX_PUFF_SIZE * GFX_PUFF_SIZE * 4];
+
+    for (uint32_t y = 0; y < GFX_PUFF_SIZE; y++) {
+        for (uint32_t x = 0; x < GFX_PUFF_SIZE; x++) {
+            float dx = (x + 0.5f) / GFX_PUFF_SIZE * 2.f - 1.f;
+            float dy = (y + 0.5f) / GFX_PUFF_SIZE * 2.f - 1.f;
+            float k = fmaxf(1.f - sqrtf(dx * dx + dy * dy), 0.f);
+            uint8_t *p = &pixels[(x + y * GFX_PUFF_SIZE) * 4];
+
+            p[0] = p[1] = p[2] = 255;
+            p[3] = (uint8_t)(k * k * (3.f - 2.f * k) * 255.f + 0.5f);
+        }
+    }
+
+    glwrapGenTextures(1, &gfx.puff_texture);
+    gfx_state_bind_texture(0, gfx.puff_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GFX_PUFF_SIZE, GFX_PUFF_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+void gfx_particles_deinit()
+{
+    gfx_state_forget_texture(gfx.puff_texture);
+    glwrapDeleteTextures(1, &gfx.puff_texture);
+}
+
+/*
+ * capacity is rounded up to 4, every array gets a 16 byte aligned slice of
+ * one block. The update loop reads whole groups of 4, so the padding lanes
+ * are zeroed to keep them finite.
+ */
+void gfx_emitter_create(gfx_emitter_t *e, textureid_t tx, uint32_t capacity, rgbaf color, float drag)
+{
+    float *block;
+
+    memset(e, 0, sizeof(*e));
+    e->tx = tx;
+    e->color = color;
+    e->drag = drag;
+    e->capacity = (capacity + 3) & ~3u;
+
+    block = sys_aligned_malloc(9 * e->capacity * sizeof(float), 16);
+    memset(block, 0, 9 * e->capacity * sizeof(float));
+    e->x = block;
+    e->y = e->x + e->capacity;
+    e->vx = e->y + e->capacity;
+    e->vy = e->vx + e->capacity;
+    e->size = e->vy + e->capacity;
+    e->growth = e->size + e->capacity;
+    e->age = e->growth + e->capacity;
+    e->inv_life = e->age + e->capacity;
+    e->alpha = e->inv_life + e->capacity;
+
+    e->instances = sys_malloc(e->capacity * sizeof(gfx_instance_t));
+}
+
+void gfx_emitter_destroy(gfx_emitter_t *e)
+{
+    sys_aligned_free(e->x);
+    sys_free(e->instances);
+    memset(e, 0, sizeof(*e));
+}
+
+/* life is in ticks, the particle is dropped when the emitter is full */
+void gfx_emitter_spawn(gfx_emitter_t *e, vec2f pos, vec2f vel, float size, float growth, uint32_t life)
+{
+    uint32_t i = e->count;
+
+    if (i == e->capacity)
+        return;
+
+    e->x[i] = pos.x;
+    e->y[i] = pos.y;
+    e->vx[i] = vel.x;
+    e->vy[i] = vel.y;
+    e->size[i] = size;
+    e->growth[i] = growth;
+    e->age[i] = 0.f;
+    e->inv_life[i] = 1.f / max(life, 1);
+    e->alpha[i] = 1.f;
+    e->count++;
+}
+
+static void gfx_emitter_remove(gfx_emitter_t *e, uint32_t i)
+{
+    uint32_t last = --e->count;
+
+    e->x[i] = e->x[last];
+    e->y[i] = e->y[last];
+    e->vx[i] = e->vx[last];
+    e->vy[i] = e->vy[last];
+    e->size[i] = e->size[last];
+    e->growth[i] = e->growth[last];
+    e->age[i] = e->age[last];
+    e->inv_life[i] = e->inv_life[last];
+    e->alpha[i] = e->alpha[last];
+}
+
+/*
+ * One tick: integrate, age and fade. The last group of four may run past
+ * count into unused slots, that is fine since capacity is a multiple of 4.
+ */
+void gfx_emitter_update(gfx_emitter_t *e)
+{
+    const simd4f drag = simd4f_splat(e->drag);
+    const simd4f one = simd4f_splat(1.f);
+    const simd4f zero = simd4f_splat(0.f);
+
+    for (uint32_t i = 0; i < e->count; i += 4) {
+        simd4f vx = simd4f_mul(simd4f_load(e->vx + i), drag);
+        simd4f vy = simd4f_mul(simd4f_load(e->vy + i), drag);
+        simd4f age = simd4f_add(simd4f_load(e->age + i), one);
+        simd4f fade = simd4f_sub(one, simd4f_mul(age, simd4f_load(e->inv_life + i)));
+
+        simd4f_store(e->x + i, simd4f_add(simd4f_load(e->x + i), vx));
+        simd4f_store(e->y + i, simd4f_add(simd4f_load(e->y + i), vy));
+        simd4f_store(e->vx + i, vx);
+        simd4f_store(e->vy + i, vy);
+        simd4f_store(e->size + i, simd4f_add(simd4f_load(e->size + i), simd4f_load(e->growth + i)));
+        simd4f_store(e->age + i, age);
+        simd4f_store(e->alpha + i, simd4f_max(fade, zero));
+    }
+
+    for (uint32_t i = 0; i < e->count;) {
+        if (e->alpha[i] <= 0.f || e->size[i] <= 0.f)
+            gfx_emitter_remove(e, i);
+        else
+            i++;
+    }
+}
+
+/*
+ * Records every particle with the current layer, shader and view. Positions
+ * are extrapolated by sys.interpolation like entities, the shader needs
+ * SHADER_TINT for the color and fade to show.
+ */
+void gfx_emitter_draw(gfx_emitter_t *e)
+{
+    const affine2d *v = &gfx.view;
+    float k = sys.interpolation;
+    uint8_t r = (uint8_t)(e->color.r * 255.f + 0.5f);
+    uint8_t g = (uint8_t)(e->color.g * 255.f + 0.5f);
+    uint8_t b = (uint8_t)(e->color.b * 255.f + 0.5f);
+
+    for (uint32_t i = 0; i < e->count; i++) {
+        gfx_instance_t *inst = &e->instances[i];
+        float s = e->size[i];
+        float x = e->x[i] + e->vx[i] * k - s * 0.5f;
+        float y = e->y[i] + e->vy[i] * k - s * 0.5f;
+
+        /* view * [s 0 x; 0 s y] */
+        inst->xform.a = v->a * s;
+        inst->xform.b = v->b * s;
+        inst->xform.tx = v->a * x + v->b * y + v->tx;
+        inst->xform.c = v->c * s;
+        inst->xform.d = v->d * s;
+        inst->xform.ty = v->c * x + v->d * y + v->ty;
+        inst->texrect[0] = inst->texrect[1] = 0.f;
+        inst->texrect[2] = inst->texrect[3] = 1.f;
+        inst->tint[0] = r;
+        inst->tint[1] = g;
+        inst->tint[2] = b;
+        inst->tint[3] = (uint8_t)(e->color.a * e->alpha[i] * 255.f + 0.5f);
+    }
+
+    gfx_push_instances(e->tx, e->instances, e->count);
+}
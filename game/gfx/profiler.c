@@ -0,0 +1,185 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+
+#include <stdio.h>
+
+/*
+ * Per layer CPU and GPU timing. Every scope issues a pair of GL_TIMESTAMP
+ * queries, the pair is read GFX_PROF_LATENCY frames later. Results that
+ * aren't ready by then are dropped instead of waiting for the GPU.
+ * Scopes don't nest, an inner begin/end is ignored so the work counts
+ * towards the outer pass only (e.g. chunk renders inside the tile pass).
+ */
+
+typedef struct gfx_prof_scope {
+    gfx_layer_t pass;
+    uint64_t cpu_begin, cpu_end;        /* usec */
+    uint64_t gpu_begin, gpu_end;        /* usec on the CPU clock, 0 if lost */
+} gfx_prof_scope_t;
+
+typedef struct gfx_prof_frame {
+    uint64_t index;
+    uint32_t n_scopes;
+    bool resolved;
+    gfx_prof_scope_t scopes[GFX_PROF_MAX_SCOPES];
+} gfx_prof_frame_t;
+
+static struct {
+    GLuint queries[GFX_PROF_LATENCY][GFX_PROF_MAX_SCOPES * 2];
+    gfx_prof_frame_t history[GFX_PROF_HISTORY];
+    gfx_prof_frame_t *frame;
+    uint32_t depth;
+
+    /* GL_TIMESTAMP and sys_get_time_usec at the same moment */
+    uint64_t gpu_epoch_ns, cpu_epoch_usec;
+} prof;
+
+static const char *layer_names[GFX_LAYER_COUNT] = {
+    [GFX_LAYER_TILES]       = "tiles",
+    [GFX_LAYER_DECALS]      = "decals",
+    [GFX_LAYER_ENTITIES]    = "entities",
+    [GFX_LAYER_GUI]         = "gui",
+    [GFX_LAYER_TEXT]        = "text",
+};
+
+const char* gfx_layer_name(gfx_layer_t layer)
+{
+    return layer_names[layer];
+}
+
+void gfx_prof_init()
+{
+    GLint64 now;
+
+    glGenQueries(GFX_PROF_LATENCY * GFX_PROF_MAX_SCOPES * 2, prof.queries[0]);
+
+    glGetInteger64v(GL_TIMESTAMP, &now);
+    prof.gpu_epoch_ns = now;
+    prof.cpu_epoch_usec = sys_get_time_usec();
+}
+
+void gfx_prof_deinit()
+{
+    glDeleteQueries(GFX_PROF_LATENCY * GFX_PROF_MAX_SCOPES * 2, prof.queries[0]);
+    memset(&prof, 0, sizeof(prof));
+}
+
+static inline uint64_t gfx_prof_gpu_to_cpu(GLuint64 ns)
+{
+    return prof.cpu_epoch_usec + (int64_t)(ns - prof.gpu_epoch_ns) / 1000;
+}
+
+/* reads back the frame that last used this query slot and publishes its totals */
+static void gfx_prof_resolve(gfx_prof_frame_t *f, GLuint *queries)
+{
+    gfx_prof_stats_t stats = { .frame = f->index };
+
+    for (uint32_t i = 0; i < f->n_scopes; i++) {
+        gfx_prof_scope_t *s = &f->scopes[i];
+        GLint available = 0;
+        GLuint64 begin, end;
+
+        glGetQueryObjectiv(queries[2 * i + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            glGetQueryObjectui64v(queries[2 * i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[2 * i + 1], GL_QUERY_RESULT, &end);
+            s->gpu_begin = gfx_prof_gpu_to_cpu(begin);
+            s->gpu_end = gfx_prof_gpu_to_cpu(end);
+            stats.gpu_ms[s->pass] += (end - begin) / 1e6f;
+        }
+        else {
+            s->gpu_begin = s->gpu_end = 0;
+            stats.n_lost++;
+        }
+
+        stats.cpu_ms[s->pass] += (s->cpu_end - s->cpu_begin) / 1e3f;
+    }
+
+    f->resolved = true;
+    gfx.prof = stats;
+}
+
+void gfx_prof_begin_frame()
+{
+    uint32_t slot = gfx.frame_index % GFX_PROF_LATENCY;
+
+    if (gfx.frame_index >= GFX_PROF_LATENCY)
+        gfx_prof_resolve(&prof.history[(gfx.frame_index - GFX_PROF_LATENCY) % GFX_PROF_HISTORY], prof.queries[slot]);
+
+    prof.frame = &prof.history[gfx.frame_index % GFX_PROF_HISTORY];
+    prof.frame->index = gfx.frame_index;
+    prof.frame->n_scopes = 0;
+    prof.frame->resolved = false;
+    prof.depth = 0;
+}
+
+void gfx_prof_begin(gfx_layer_t pass)
+{
+    gfx_prof_scope_t *s;
+    GLuint *queries;
+
+    if (prof.frame == NULL || prof.depth++ > 0 || prof.frame->n_scopes == GFX_PROF_MAX_SCOPES)
+        return;
+
+    queries = prof.queries[gfx.frame_index % GFX_PROF_LATENCY];
+    s = &prof.frame->scopes[prof.frame->n_scopes];
+    s->pass = pass;
+    s->cpu_begin = sys_get_time_usec();
+    glQueryCounter(queries[2 * prof.frame->n_scopes], GL_TIMESTAMP);
+}
+
+void gfx_prof_end()
+{
+    GLuint *queries;
+
+    if (prof.frame == NULL || prof.depth == 0 || --prof.depth > 0 || prof.frame->n_scopes == GFX_PROF_MAX_SCOPES)
+        return;
+
+    queries = prof.queries[gfx.frame_index % GFX_PROF_LATENCY];
+    glQueryCounter(queries[2 * prof.frame->n_scopes + 1], GL_TIMESTAMP);
+    prof.frame->scopes[prof.frame->n_scopes++].cpu_end = sys_get_time_usec();
+}
+
+static void gfx_prof_write_event(file_handle_t f, bool *first, const char *name, const char *thread, uint64_t frame, uint64_t begin, uint64_t end)
+{
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+        "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":\"%s\",\"ts\":%llu,\"dur\":%llu,\"args\":{\"frame\":%llu}}",
+        *first ? "" : ",", name, thread, thread,
+        (unsigned long long)begin, (unsigned long long)(end - begin), (unsigned long long)frame);
+
+    sys_write_file(f, line, len);
+    *first = false;
+}
+
+/* every resolved frame still in the history, as a chrome://tracing / Perfetto json */
+bool gfx_prof_write_trace(const char *path)
+{
+    file_handle_t f = sys_try_open_file(path, "wb");
+    bool first = true;
+
+    if (!f)
+        return false;
+
+    sys_write_file(f, "[", 1);
+
+    for (uint32_t i = 0; i < GFX_PROF_HISTORY; i++) {
+        gfx_prof_frame_t *fr = &prof.history[(gfx.frame_index + 1 + i) % GFX_PROF_HISTORY];
+        if (!fr->resolved)
+            continue;
+
+        for (uint32_t j = 0; j < fr->n_scopes; j++) {
+            gfx_prof_scope_t *s = &fr->scopes[j];
+
+            gfx_prof_write_event(f, &first, layer_names[s->pass], "CPU", fr->index, s->cpu_begin, s->cpu_end);
+            if (s->gpu_end)
+                gfx_prof_write_event(f, &first, layer_names[s->pass], "GPU", fr->index, s->gpu_begin, s->gpu_end);
+        }
+    }
+
+    sys_write_file(f, "\n]\n", 3);
+    sys_close_file(f);
+    return true;
+}
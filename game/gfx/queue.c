@@ -0,0 +1,206 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+
+/* ************* *
+ * COMMAND QUEUE *
+ * ************* */
+
+#define GFX_CMDBUF_INITIAL_CAPACITY 1024
+
+void gfx_cmdbuf_create(gfx_cmdbuf_t *buf)
+{
+    buf->size = 0;
+    buf->capacity = GFX_CMDBUF_INITIAL_CAPACITY;
+    buf->cmds = sys_malloc(buf->capacity * sizeof(gfx_cmd_t));
+}
+
+void gfx_cmdbuf_destroy(gfx_cmdbuf_t *buf)
+{
+    sys_free(buf->cmds);
+    buf->cmds = NULL;
+    buf->size = buf->capacity = 0;
+}
+
+static void gfx_cmdbuf_reserve(gfx_cmdbuf_t *buf, uint32_t capacity)
+{
+    if (capacity <= buf->capacity)
+        return;
+
+    while (buf->capacity < capacity)
+        buf->capacity *= 2;
+
+    buf->cmds = sys_realloc(buf->cmds, buf->capacity * sizeof(gfx_cmd_t));
+}
+
+/* returned command is uninitialized */
+gfx_cmd_t* gfx_cmdbuf_push(gfx_cmdbuf_t *buf)
+{
+    gfx_cmdbuf_reserve(buf, buf->size + 1);
+    return &buf->cmds[buf->size++];
+}
+
+/*
+ * LSD radix sort, one byte per pass. Stable, result ends up in items.
+ * Bytes that are equal for all keys (unused layers, depth) are skipped.
+ */
+void gfx_sort_keys(gfx_sort_item_t *items, gfx_sort_item_t *tmp, uint32_t n)
+{
+    uint32_t hist[8][256];
+    gfx_sort_item_t *src = items, *dst = tmp;
+
+    if (n < 2)
+        return;
+
+    memset(hist, 0, sizeof(hist));
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t key = items[i].key;
+        for (uint32_t pass = 0; pass < 8; pass++)
+            hist[pass][(key >> (pass * 8)) & 0xFF]++;
+    }
+
+    for (uint32_t pass = 0; pass < 8; pass++) {
+        uint32_t *h = hist[pass];
+        uint32_t shift = pass * 8;
+        uint32_t offset = 0;
+
+        if (h[(items[0].key >> shift) & 0xFF] == n)
+            continue;
+
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t count = h[b];
+            h[b] = offset;
+            offset += count;
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+            dst[h[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+        gfx_sort_item_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != items)
+        memcpy(items, src, n * sizeof(gfx_sort_item_t));
+}
+
+/* sorts this frame's commands and draws them, batching runs of equal shader and texture */
+void gfx_submit()
+{
+    gfx_cmdbuf_t *q = &gfx.queue;
+    gfx_layer_t pass = GFX_LAYER_COUNT;
+    bool scaled = gfx.dynres.submitting && gfx.dynres.enabled && gfx.dynres.scale < 1.f;
+    bool in_world = false;
+
+    if (q->size == 0)
+        return;
+
+    if (gfx.sort_capacity < q->size) {
+        gfx.sort_capacity = q->capacity;
+        gfx.sort_items = sys_realloc(gfx.sort_items, gfx.sort_capacity * sizeof(gfx_sort_item_t));
+        gfx.sort_tmp = sys_realloc(gfx.sort_tmp, gfx.sort_capacity * sizeof(gfx_sort_item_t));
+    }
+
+    for (uint32_t i = 0; i < q->size; i++) {
+        gfx.sort_items[i].key = q->cmds[i].key;
+        gfx.sort_items[i].index = i;
+    }
+
+    gfx_sort_keys(gfx.sort_items, gfx.sort_tmp, q->size);
+
+    for (uint32_t i = 0; i < q->size; i++) {
+        gfx_cmd_t *cmd = &q->cmds[gfx.sort_items[i].index];
+        shader_t *sh = &gfx.shaders[cmd->variant];
+        gfx_layer_t layer = (gfx_layer_t)(cmd->key >> 56);
+
+        /* each layer is its own profiler pass */
+        if (layer != pass) {
+            gfx_flush();
+            if (pass != GFX_LAYER_COUNT) gfx_prof_end();
+
+            /* unordered layers are the world, see gfx/dynres.c */
+            if (scaled && in_world != !GFX_LAYER_IS_ORDERED(layer)) {
+                in_world = !in_world;
+                if (in_world) gfx_dynres_begin_world();
+                else gfx_dynres_end_world();
+            }
+
+            gfx_prof_begin(layer);
+            pass = layer;
+        }
+
+        /* meshes bring their own program and vao */
+        if (cmd->variant == GFX_VARIANT_MESH) {
+            gfx_flush();
+            gfx_draw_geometry(cmd->mesh.geometry, cmd->mesh.mvp);
+            continue;
+        }
+
+        /* prebuilt batches are drawn on their own */
+        if (cmd->n_instances) {
+            gfx_flush();
+            gfx.shader = sh;
+            gfx_draw_instances(cmd->tx, cmd->instances, cmd->n_instances);
+            continue;
+        }
+
+        if (sh != gfx.shader || cmd->tx != gfx.batch_tx || gfx.batch_size == GFX_MAX_INSTANCES) {
+            gfx_flush();
+            gfx.shader = sh;
+            gfx.batch_tx = cmd->tx;
+        }
+
+        gfx.batch[gfx.batch_size++] = cmd->inst;
+    }
+
+    gfx_flush();
+    gfx_prof_end();
+    if (in_world) gfx_dynres_end_world();
+    q->size = 0;
+}
+
+/* **************** *
+ * OFFSCREEN PASSES *
+ * **************** */
+
+/*
+ * Draws go through queue and into fbo until gfx_offscreen_end, so whatever
+ * the frame has recorded so far stays put. Recording state is restored at
+ * the end, callers set their own matrices, layer and shader in between.
+ */
+void gfx_offscreen_begin(gfx_offscreen_t *o, gfx_cmdbuf_t *queue, GLuint fbo, GLsizei w, GLsizei h)
+{
+    o->queue = queue;
+    o->frame_queue = gfx.queue;
+    o->view = gfx.view;
+    o->proj = gfx.proj;
+    o->color = gfx.color;
+    o->layer = gfx.layer;
+    o->variant = gfx.variant;
+    o->depth = gfx.depth;
+    o->framebuffer = gfx.state.framebuffer;
+    memcpy(o->viewport, gfx.state.viewport, sizeof(o->viewport));
+
+    gfx.queue = *queue;
+    gfx_state_bind_framebuffer(fbo);
+    gfx_state_set_viewport(0, 0, w, h);
+}
+
+void gfx_offscreen_end(gfx_offscreen_t *o)
+{
+    gfx_submit();
+    *o->queue = gfx.queue;
+
+    gfx.queue = o->frame_queue;
+    gfx_set_proj_matrix(&o->proj);
+    gfx_set_view_matrix(&o->view);
+    gfx_set_color(o->color);
+    gfx.layer = o->layer;
+    gfx.variant = o->variant;
+    gfx.depth = o->depth;
+
+    gfx_state_bind_framebuffer(o->framebuffer);
+    gfx_state_set_viewport(o->viewport[0], o->viewport[1], o->viewport[2], o->viewport[3]);
+}
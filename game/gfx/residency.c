@@ -0,0 +1,270 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+
+/*
+ * Texture residency. Every cached texture is refcounted by asset id, released
+ * textures stay resident until the VRAM budget runs out, then the least
+ * recently released unreferenced ones are deleted first.
+ *
+ * Unreferenced textures sit on an idle list in release order, linked by
+ * asset id so the array can grow under it. assets[0] is never a real asset
+ * and serves as the list head. Evicted textures are only deleted after the
+ * frame is submitted, the queue may still hold draws that bind them.
+ */
+
+typedef struct asset {
+    textureid_t tx;         /* 0 while not resident */
+    size_t bytes;           /* every mip level in the upload format */
+    uint32_t refs;
+    asset_id_t idle_prev;   /* idle list links, only while refs is 0 */
+    asset_id_t idle_next;
+} asset_t;
+
+static asset_t *assets;             /* indexed by asset_id_t */
+static uint32_t n_assets;
+static asset_id_t *by_texture;      /* indexed by textureid_t, for the calls that only have the handle */
+static uint32_t n_by_texture;
+static textureid_t *dead;           /* evicted this frame, deleted by gfx_residency_collect */
+static uint32_t n_dead, dead_capacity;
+
+void gfx_residency_init()
+{
+    gfx.textures.budget_bytes = GFX_TEXTURE_BUDGET;
+}
+
+void gfx_residency_deinit()
+{
+    gfx_residency_collect();
+
+    for (asset_id_t id = 1; id < n_assets; id++) {
+        asset_t *a = &assets[id];
+        if (a->tx == 0)
+            continue;
+
+        if (a->refs)
+            RENG_LOGF("Unloaded texture: %s (%u refs)", asset_name(id), a->refs);
+
+        glwrapDeleteTextures(1, &a->tx);
+    }
+
+    sys_free(assets);
+    sys_free(by_texture);
+    sys_free(dead);
+    assets = NULL;
+    by_texture = NULL;
+    dead = NULL;
+    n_assets = n_by_texture = 0;
+    dead_capacity = 0;
+
+    gfx.textures.resident_bytes = 0;
+    gfx.textures.n_resident = 0;
+}
+
+static asset_id_t gfx_residency_by_texture(textureid_t tx)
+{
+    return tx < n_by_texture ? by_texture[tx] : 0;
+}
+
+/* appends to the tail, the head is the least recently released */
+static void gfx_residency_idle_link(asset_id_t id)
+{
+    asset_t *a = &assets[id];
+
+    a->idle_prev = assets[0].idle_prev;
+    a->idle_next = 0;
+    assets[a->idle_prev].idle_next = id;
+    assets[0].idle_prev = id;
+}
+
+static void gfx_residency_idle_unlink(asset_id_t id)
+{
+    asset_t *a = &assets[id];
+
+    assets[a->idle_prev].idle_next = a->idle_next;
+    assets[a->idle_next].idle_prev = a->idle_prev;
+    a->idle_prev = a->idle_next = 0;
+}
+
+static void gfx_residency_evict(asset_id_t id)
+{
+    asset_t *a = &assets[id];
+
+    gfx_residency_idle_unlink(id);
+    gfx_stream_cancel(a->tx);
+    by_texture[a->tx] = 0;
+
+    if (n_dead == dead_capacity) {
+        dead_capacity = max(16, dead_capacity * 2);
+        dead = sys_realloc(dead, dead_capacity * sizeof(textureid_t));
+    }
+    dead[n_dead++] = a->tx;
+
+    gfx.textures.resident_bytes -= a->bytes;
+    gfx.textures.n_resident--;
+    gfx.textures.n_evicted++;
+    *a = (asset_t) { 0 };
+}
+
+/* evicts unreferenced textures, oldest first, until the budget fits */
+static void gfx_residency_trim()
+{
+    /* once the idle list is empty everything left is in use, stay over budget */
+    while (gfx.textures.resident_bytes > gfx.textures.budget_bytes && assets[0].idle_next != 0)
+        gfx_residency_evict(assets[0].idle_next);
+}
+
+/* render targets live outside the cache but still take VRAM, so they count against the budget */
+void gfx_residency_charge(size_t bytes)
+{
+    gfx.textures.resident_bytes += bytes;
+    gfx_residency_trim();
+}
+
+void gfx_residency_refund(size_t bytes)
+{
+    gfx.textures.resident_bytes -= bytes;
+}
+
+/* deletes what was evicted since the last call, once nothing recorded can bind it */
+void gfx_residency_collect()
+{
+    for (uint32_t i = 0; i < n_dead; i++)
+        gfx_state_forget_texture(dead[i]);
+
+    if (n_dead)
+        glwrapDeleteTextures(n_dead, dead);
+    n_dead = 0;
+}
+
+static textureid_t gfx_residency_acquire(asset_id_t id)
+{
+    asset_t *a = &assets[id];
+
+    if (a->refs++ == 0)
+        gfx_residency_idle_unlink(id);
+    return a->tx;
+}
+
+static void gfx_residency_add(asset_id_t id, textureid_t tx, size_t bytes)
+{
+    if (id >= n_assets) {
+        uint32_t n = max(asset_count(), n_assets * 2);
+
+        assets = sys_realloc(assets, n * sizeof(asset_t));
+        memset(assets + n_assets, 0, (n - n_assets) * sizeof(asset_t));
+        n_assets = n;
+    }
+
+    if (tx >= n_by_texture) {
+        uint32_t n = max(tx + 1, n_by_texture * 2);
+
+        by_texture = sys_realloc(by_texture, n * sizeof(asset_id_t));
+        memset(by_texture + n_by_texture, 0, (n - n_by_texture) * sizeof(asset_id_t));
+        n_by_texture = n;
+    }
+
+    assets[id] = (asset_t) {
+        .tx = tx,
+        .bytes = bytes,
+        .refs = 1
+    };
+    by_texture[tx] = id;
+
+    gfx.textures.resident_bytes += bytes;
+    gfx.textures.n_resident++;
+    gfx_residency_trim();
+}
+
+static void gfx_residency_release(asset_id_t id)
+{
+    asset_t *a = &assets[id];
+
+    if (a->refs == 0) {
+        RENG_LOGF("Texture %s released more times than cached", asset_name(id));
+        return;
+    }
+
+    if (--a->refs == 0) {
+        gfx_residency_idle_link(id);
+        gfx_residency_trim();
+    }
+}
+
+static asset_t* gfx_residency_find(asset_id_t id)
+{
+    return id < n_assets && assets[id].tx ? &assets[id] : NULL;
+}
+
+/* every call takes a reference, pair it with gfx_uncache_texture or gfx_release_texture */
+textureid_t gfx_cache_texture(asset_id_t id, unsigned int filter)
+{
+    textureid_t tx;
+    size_t bytes;
+    asset_t *find = gfx_residency_find(id);
+
+    if (find != NULL)
+        return gfx_residency_acquire(id);
+    if (id == 0)
+        return 0;
+
+    tx = gfx_load_texture((char*)asset_name(id), filter, &bytes);
+    if (tx != 0)
+        gfx_residency_add(id, tx, bytes);
+
+    return tx;
+}
+
+/* returns at once, the texture shows a placeholder until it is streamed in */
+textureid_t gfx_cache_texture_async(asset_id_t id, unsigned int filter)
+{
+    textureid_t tx;
+    asset_t *find = gfx_residency_find(id);
+
+    if (find != NULL)
+        return gfx_residency_acquire(id);
+    if (id == 0)
+        return 0;
+
+    tx = gfx_stream_texture(asset_name(id), filter);
+    gfx_residency_add(id, tx, 4);           /* the placeholder, see gfx_set_texture_bytes */
+
+    return tx;
+}
+
+void gfx_uncache_texture(asset_id_t id)
+{
+    if (gfx_residency_find(id) != NULL)
+        gfx_residency_release(id);
+}
+
+/* same as gfx_uncache_texture, for owners that only kept the handle */
+void gfx_release_texture(textureid_t tx)
+{
+    asset_id_t id = gfx_residency_by_texture(tx);
+
+    if (id != 0)
+        gfx_residency_release(id);
+}
+
+/* streamed textures learn their real size once the cooked header is read */
+void gfx_set_texture_bytes(textureid_t tx, size_t bytes)
+{
+    asset_id_t id = gfx_residency_by_texture(tx);
+    asset_t *a;
+
+    if (id == 0)
+        return;
+
+    a = &assets[id];
+    gfx.textures.resident_bytes += bytes - a->bytes;
+    a->bytes = bytes;
+    gfx_residency_trim();
+}
+
+void gfx_set_texture_budget(size_t bytes)
+{
+    gfx.textures.budget_bytes = bytes;
+    gfx_residency_trim();
+}
@@ -0,0 +1,369 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+
+#define STBI_MALLOC(sz)           sys_malloc(sz)
+#define STBI_REALLOC(p,newsz)     sys_realloc(p,newsz)
+#define STBI_FREE(p)              sys_free(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include "..\other\stb_image.h"
+
+/*
+ * Cooked textures live next to the source as "<name>.cooked": a header,
+ * then every mip level already converted to the upload format. Warm loads
+ * map the file and hand the levels to glTexImage2D as they are.
+ */
+
+#define GFX_COOKED_MAGIC        0x58455452      /* "RTEX" */
+#define GFX_COOKED_VERSION      1
+#define GFX_COOKED_MAX_MIPS     16
+
+typedef struct gfx_cooked_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t format;                /* GFX_COOKED_* */
+    uint32_t channels;              /* of the source png, 3 keeps an rgb internal format */
+    uint32_t n_mips;
+    uint32_t src_hash;
+    uint64_t src_mtime;
+    uint64_t src_size;
+    uint32_t mip_offsets[GFX_COOKED_MAX_MIPS];      /* from the start of the file */
+} gfx_cooked_header_t;
+
+static const struct {
+    GLenum format, type;
+    uint32_t bpp;
+} cooked_formats[GFX_COOKED_FORMAT_COUNT] = {
+    [GFX_COOKED_RGBA8]      = { GL_RGBA,    GL_UNSIGNED_BYTE,           4 },
+    [GFX_COOKED_RGB565]     = { GL_RGB,     GL_UNSIGNED_SHORT_5_6_5,    2 },
+    [GFX_COOKED_RGBA4444]   = { GL_RGBA,    GL_UNSIGNED_SHORT_4_4_4_4,  2 },
+};
+
+static uint32_t gfx_fnv1a(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+static uint32_t gfx_hash_file(const char *path)
+{
+    size_t size;
+    uint32_t hash;
+    void *data = sys_map_file(path, &size);
+
+    if (data == NULL)
+        return 0;
+
+    hash = gfx_fnv1a(data, size);
+    sys_unmap_file(data, size);
+    return hash;
+}
+
+/* true if the 8-bit channel survives a trip through <bits> bits and bit replication back */
+static bool gfx_channel_fits(uint8_t v, uint32_t bits)
+{
+    return v == (uint8_t)((v >> (8 - bits)) << (8 - bits) | v >> bits);
+}
+
+/* smallest format that stores every texel of level 0 exactly */
+static uint32_t gfx_pick_cooked_format(const uint8_t *rgba, size_t n_texels)
+{
+    bool fits565 = true, fits4444 = true;
+
+    for (size_t i = 0; i < n_texels && (fits565 || fits4444); i++) {
+        const uint8_t *t = rgba + 4 * i;
+
+        if (t[3] != 255 || !gfx_channel_fits(t[0], 5) || !gfx_channel_fits(t[1], 6) || !gfx_channel_fits(t[2], 5))
+            fits565 = false;
+
+        if (t[0] % 17 || t[1] % 17 || t[2] % 17 || t[3] % 17)
+            fits4444 = false;
+    }
+
+    if (fits565) return GFX_COOKED_RGB565;
+    if (fits4444) return GFX_COOKED_RGBA4444;
+    return GFX_COOKED_RGBA8;
+}
+
+/* 2x2 box filter, odd edges repeat the last texel */
+static void gfx_downsample(const uint8_t *src, uint32_t sw, uint32_t sh, uint8_t *dst, uint32_t dw, uint32_t dh)
+{
+    for (uint32_t y = 0; y < dh; y++) {
+        uint32_t y0 = min(2 * y, sh - 1), y1 = min(2 * y + 1, sh - 1);
+
+        for (uint32_t x = 0; x < dw; x++) {
+            uint32_t x0 = min(2 * x, sw - 1), x1 = min(2 * x + 1, sw - 1);
+
+            for (uint32_t c = 0; c < 4; c++) {
+                uint32_t sum = src[4 * (y0 * sw + x0) + c] + src[4 * (y0 * sw + x1) + c]
+                             + src[4 * (y1 * sw + x0) + c] + src[4 * (y1 * sw + x1) + c];
+                dst[4 * (y * dw + x) + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+static void gfx_convert_level(const uint8_t *rgba, size_t n_texels, uint32_t format, uint8_t *dst)
+{
+    uint16_t *dst16 = (uint16_t*)dst;
+
+    switch (format) {
+        case GFX_COOKED_RGB565:
+            for (size_t i = 0; i < n_texels; i++, rgba += 4)
+                dst16[i] = (uint16_t)((rgba[0] >> 3) << 11 | (rgba[1] >> 2) << 5 | (rgba[2] >> 3));
+            break;
+
+        case GFX_COOKED_RGBA4444:
+            for (size_t i = 0; i < n_texels; i++, rgba += 4)
+                dst16[i] = (uint16_t)((rgba[0] >> 4) << 12 | (rgba[1] >> 4) << 8 | (rgba[2] >> 4) << 4 | (rgba[3] >> 4));
+            break;
+
+        default:
+            memcpy(dst, rgba, n_texels * 4);
+            break;
+    }
+}
+
+static inline size_t gfx_align4(size_t v)
+{
+    return (v + 3) & ~(size_t)3;
+}
+
+/* decodes the png and builds the cooked image in memory, 4-aligned levels */
+static bool gfx_cook_texture(const char *path, uint64_t src_mtime, uint64_t src_size, gfx_cooked_texture_t *ct)
+{
+    int width, height, channels;
+    uint8_t *levels[GFX_COOKED_MAX_MIPS];
+    uint32_t widths[GFX_COOKED_MAX_MIPS], heights[GFX_COOKED_MAX_MIPS];
+    gfx_cooked_header_t *h;
+    uint32_t n_mips = 1;
+    size_t size;
+
+    levels[0] = stbi_load(path, &width, &height, &channels, 4);
+    if (levels[0] == NULL)
+        return false;
+
+    widths[0] = width;
+    heights[0] = height;
+
+    while ((widths[n_mips - 1] > 1 || heights[n_mips - 1] > 1) && n_mips < GFX_COOKED_MAX_MIPS) {
+        uint32_t w = max(widths[n_mips - 1] / 2, 1), hh = max(heights[n_mips - 1] / 2, 1);
+
+        levels[n_mips] = sys_malloc(4 * w * hh);
+        gfx_downsample(levels[n_mips - 1], widths[n_mips - 1], heights[n_mips - 1], levels[n_mips], w, hh);
+        widths[n_mips] = w;
+        heights[n_mips] = hh;
+        n_mips++;
+    }
+
+    uint32_t format = gfx_pick_cooked_format(levels[0], (size_t)width * height);
+    uint32_t bpp = cooked_formats[format].bpp;
+
+    size = gfx_align4(sizeof(gfx_cooked_header_t));
+    for (uint32_t i = 0; i < n_mips; i++)
+        size += gfx_align4((size_t)bpp * widths[i] * heights[i]);
+
+    ct->data = sys_malloc(size);
+    ct->size = size;
+    ct->mapped = false;
+
+    h = (gfx_cooked_header_t*)ct->data;
+    memset(h, 0, sizeof(*h));
+    h->magic = GFX_COOKED_MAGIC;
+    h->version = GFX_COOKED_VERSION;
+    h->width = width;
+    h->height = height;
+    h->format = format;
+    h->channels = channels;
+    h->n_mips = n_mips;
+    h->src_hash = gfx_hash_file(path);
+    h->src_mtime = src_mtime;
+    h->src_size = src_size;
+
+    size = gfx_align4(sizeof(gfx_cooked_header_t));
+    for (uint32_t i = 0; i < n_mips; i++) {
+        h->mip_offsets[i] = (uint32_t)size;
+        gfx_convert_level(levels[i], (size_t)widths[i] * heights[i], format, ct->data + size);
+        size += gfx_align4((size_t)bpp * widths[i] * heights[i]);
+    }
+
+    stbi_image_free(levels[0]);
+    for (uint32_t i = 1; i < n_mips; i++)
+        sys_free(levels[i]);
+
+    return true;
+}
+
+static bool gfx_cooked_header_valid(const gfx_cooked_texture_t *ct)
+{
+    const gfx_cooked_header_t *h = (const gfx_cooked_header_t*)ct->data;
+
+    if (ct->size < sizeof(gfx_cooked_header_t)
+        || h->magic != GFX_COOKED_MAGIC
+        || h->version != GFX_COOKED_VERSION
+        || h->format >= GFX_COOKED_FORMAT_COUNT
+        || h->width == 0 || h->height == 0
+        || h->n_mips < 1 || h->n_mips > GFX_COOKED_MAX_MIPS)
+        return false;
+
+    /* a truncated file must not let an upload read past the mapping */
+    for (uint32_t i = 0; i < h->n_mips; i++) {
+        uint64_t level_size = (uint64_t)cooked_formats[h->format].bpp * max(h->width >> i, 1) * max(h->height >> i, 1);
+
+        if ((uint64_t)h->mip_offsets[i] + level_size > ct->size)
+            return false;
+    }
+
+    return true;
+}
+
+/* writes next to the target and renames over it, so a reader never maps a half-written file */
+static void gfx_cooked_write(const char *cooked_path, const gfx_cooked_texture_t *ct)
+{
+    char tmp_path[260];
+    file_handle_t f;
+    bool ok;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cooked_path);
+
+    /* a read-only data folder just means every start is a cold one */
+    f = sys_try_open_file(tmp_path, "wb");
+    if (!f)
+        return;
+
+    ok = sys_write_file(f, ct->data, ct->size) == ct->size;
+    sys_close_file(f);
+
+    if (!ok || !sys_replace_file(tmp_path, cooked_path))
+        remove(tmp_path);
+}
+
+/*
+ * Maps "<path>.cooked" if it is still fresh, otherwise cooks the png and
+ * tries to write the result back. mtime and size are checked first, the
+ * content hash only when those differ (e.g. after a fresh checkout).
+ * Doesn't touch GL, safe to call from any thread.
+ */
+bool gfx_cooked_open(const char *path, gfx_cooked_texture_t *ct)
+{
+    char cooked_path[260];
+    uint64_t mtime, size;
+
+    if (!sys_get_file_info(path, &mtime, &size))
+        return false;
+
+    snprintf(cooked_path, sizeof(cooked_path), "%s.cooked", path);
+
+    ct->data = sys_map_file(cooked_path, &ct->size);
+    ct->mapped = true;
+
+    if (ct->data != NULL) {
+        const gfx_cooked_header_t *h = (const gfx_cooked_header_t*)ct->data;
+
+        if (gfx_cooked_header_valid(ct) && h->src_size == size) {
+            if (h->src_mtime == mtime)
+                return true;
+
+            /* same content under a new mtime: restamp it so the next start skips the hash */
+            if (h->src_hash == gfx_hash_file(path)) {
+                uint8_t *copy = sys_malloc(ct->size);
+                size_t copy_size = ct->size;
+
+                memcpy(copy, ct->data, copy_size);
+                gfx_cooked_close(ct);
+
+                ct->data = copy;
+                ct->size = copy_size;
+                ct->mapped = false;
+                ((gfx_cooked_header_t*)copy)->src_mtime = mtime;
+
+                gfx_cooked_write(cooked_path, ct);
+                return true;
+            }
+        }
+
+        gfx_cooked_close(ct);
+    }
+
+    if (!gfx_cook_texture(path, mtime, size, ct))
+        return false;
+
+    gfx_cooked_write(cooked_path, ct);
+    return true;
+}
+
+void gfx_cooked_close(gfx_cooked_texture_t *ct)
+{
+    if (ct->mapped) sys_unmap_file(ct->data, ct->size);
+    else sys_free(ct->data);
+
+    ct->data = NULL;
+    ct->size = 0;
+}
+
+/* keeps only the header, for when the levels were already copied elsewhere */
+void gfx_cooked_drop_levels(gfx_cooked_texture_t *ct)
+{
+    uint8_t *header = sys_malloc(sizeof(gfx_cooked_header_t));
+
+    memcpy(header, ct->data, sizeof(gfx_cooked_header_t));
+    gfx_cooked_close(ct);
+
+    ct->data = header;
+    ct->size = sizeof(gfx_cooked_header_t);
+    ct->mapped = false;
+}
+
+uint32_t gfx_cooked_levels(const gfx_cooked_texture_t *ct)
+{
+    return ((const gfx_cooked_header_t*)ct->data)->n_mips;
+}
+
+/* what the levels take once uploaded, the header excluded */
+size_t gfx_cooked_bytes(const gfx_cooked_texture_t *ct)
+{
+    const gfx_cooked_header_t *h = (const gfx_cooked_header_t*)ct->data;
+    size_t bytes = 0;
+
+    for (uint32_t i = 0; i < h->n_mips; i++)
+        bytes += (size_t)cooked_formats[h->format].bpp * max(h->width >> i, 1) * max(h->height >> i, 1);
+
+    return bytes;
+}
+
+/*
+ * Uploads one level into the bound texture. base is ct->data for client
+ * memory, or NULL when the whole cooked file sits in the bound unpack buffer.
+ */
+void gfx_cooked_upload_level(const gfx_cooked_texture_t *ct, uint32_t level, const uint8_t *base)
+{
+    const gfx_cooked_header_t *h = (const gfx_cooked_header_t*)ct->data;
+    GLenum format = cooked_formats[h->format].format;
+    GLenum type = cooked_formats[h->format].type;
+    GLint internal = (h->format == GFX_COOKED_RGBA8 && h->channels == 3) ? GL_RGB : format;
+    GLsizei w = max(h->width >> level, 1), hh = max(h->height >> level, 1);
+
+    /* 16-bit levels with odd widths have 2-byte aligned rows */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, cooked_formats[h->format].bpp);
+    glTexImage2D(GL_TEXTURE_2D, level, internal, w, hh, 0, format, type, base + h->mip_offsets[level]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/* uploads all precomputed levels of the currently bound texture, no glGenerateMipmap */
+void gfx_cooked_upload(const gfx_cooked_texture_t *ct)
+{
+    uint32_t n_mips = gfx_cooked_levels(ct);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, n_mips - 1);
+
+    for (uint32_t i = 0; i < n_mips; i++)
+        gfx_cooked_upload_level(ct, i, ct->data);
+}
@@ -0,0 +1,251 @@
+#include "../def.h"
+
+#include "../gfx.h"
+#include "../sys.h"
+
+/*
+ * Async texture loading. Workers run gfx_cooked_open (decode or map, no GL),
+ * the GL thread copies the result into a pixel buffer and uploads it one
+ * mip level at a time, coarsest first, under a per-frame time budget.
+ * GL_TEXTURE_BASE_LEVEL follows the finest uploaded level, so the texture
+ * is always complete and just gets sharper.
+ */
+
+typedef struct gfx_stream_job {
+    char path[260];
+    textureid_t tx;
+    unsigned int filter;
+
+    /* filled by the worker */
+    gfx_cooked_texture_t ct;
+    bool ok;
+
+    /* GL thread only */
+    bool cancelled;
+    GLuint pbo;
+    int32_t next_level;
+
+    struct gfx_stream_job *next;        /* in pending, decoded or uploading */
+    struct gfx_stream_job *next_all;    /* every job in flight, GL thread only */
+} gfx_stream_job_t;
+
+static struct {
+    sys_thread_t *workers[GFX_STREAM_WORKERS];
+    sys_semaphore_t *wakeup;
+    sys_mutex_t *lock;
+    bool quit;
+
+    /* guarded by lock */
+    gfx_stream_job_t *pending, **pending_tail;
+    gfx_stream_job_t *decoded;
+
+    /* GL thread only */
+    gfx_stream_job_t *uploading, **uploading_tail;
+    gfx_stream_job_t *all;
+    uint32_t n_jobs;
+} stream;
+
+static int gfx_stream_worker(void *arg)
+{
+    for (;;) {
+        gfx_stream_job_t *job;
+
+        sys_wait_semaphore(stream.wakeup);
+        sys_lock_mutex(stream.lock);
+
+        if (stream.quit) {
+            sys_unlock_mutex(stream.lock);
+            break;
+        }
+
+        job = stream.pending;
+        stream.pending = job->next;
+        if (stream.pending == NULL)
+            stream.pending_tail = &stream.pending;
+
+        sys_unlock_mutex(stream.lock);
+
+        job->ok = gfx_cooked_open(job->path, &job->ct);
+
+        sys_lock_mutex(stream.lock);
+        job->next = stream.decoded;
+        stream.decoded = job;
+        sys_unlock_mutex(stream.lock);
+    }
+
+    return 0;
+}
+
+void gfx_stream_init()
+{
+    stream.lock = sys_create_mutex();
+    stream.wakeup = sys_create_semaphore(0);
+    stream.pending_tail = &stream.pending;
+    stream.uploading_tail = &stream.uploading;
+
+    for (uint32_t i = 0; i < GFX_STREAM_WORKERS; i++)
+        stream.workers[i] = sys_create_thread(gfx_stream_worker, NULL);
+}
+
+static void gfx_stream_free_job(gfx_stream_job_t *job)
+{
+    gfx_stream_job_t **it = &stream.all;
+
+    while (*it != job)
+        it = &(*it)->next_all;
+    *it = job->next_all;
+
+    if (job->ok)
+        gfx_cooked_close(&job->ct);
+
+    if (job->pbo)
+        glwrapDeleteBuffers(1, &job->pbo);
+
+    sys_pool_free(job);
+    stream.n_jobs--;
+}
+
+/* unfinished jobs are dropped, their textures keep the placeholder */
+void gfx_stream_deinit()
+{
+    sys_lock_mutex(stream.lock);
+    stream.quit = true;
+    sys_unlock_mutex(stream.lock);
+
+    sys_post_semaphore(stream.wakeup, GFX_STREAM_WORKERS);
+    for (uint32_t i = 0; i < GFX_STREAM_WORKERS; i++)
+        sys_join_thread(stream.workers[i]);
+
+    /* queued jobs never got decoded */
+    for (gfx_stream_job_t *job = stream.pending; job; job = job->next)
+        job->ok = false;
+
+    while (stream.all)
+        gfx_stream_free_job(stream.all);
+
+    sys_destroy_semaphore(stream.wakeup);
+    sys_destroy_mutex(stream.lock);
+}
+
+/* creates the texture with a 1x1 grey placeholder and queues the real data */
+textureid_t gfx_stream_texture(const char *path, unsigned int filter)
+{
+    static const uint8_t placeholder[4] = { 128, 128, 128, 255 };
+    gfx_stream_job_t *job = sys_pool_alloc(sizeof(gfx_stream_job_t));
+
+    memset(job, 0, sizeof(*job));
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->filter = filter;
+
+    glwrapGenTextures(1, &job->tx);
+    gfx_state_bind_texture(0, job->tx);
+    gfx_set_texture_params(filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+    job->next_all = stream.all;
+    stream.all = job;
+    stream.n_jobs++;
+
+    sys_lock_mutex(stream.lock);
+    *stream.pending_tail = job;
+    stream.pending_tail = &job->next;
+    sys_unlock_mutex(stream.lock);
+
+    sys_post_semaphore(stream.wakeup, 1);
+    return job->tx;
+}
+
+/* the texture is about to be deleted, don't upload into a recycled name */
+void gfx_stream_cancel(textureid_t tx)
+{
+    for (gfx_stream_job_t *job = stream.all; job; job = job->next_all)
+        if (job->tx == tx) job->cancelled = true;
+}
+
+uint32_t gfx_stream_pending()
+{
+    return stream.n_jobs;
+}
+
+/* copies the cooked file into a pixel buffer, glTexImage2D then reads it asynchronously */
+static void gfx_stream_stage(gfx_stream_job_t *job)
+{
+    uint32_t n_mips = gfx_cooked_levels(&job->ct);
+    void *dst;
+
+    glwrapGenBuffers(1, &job->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, job->ct.size, NULL, GL_STREAM_DRAW);
+
+    dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, job->ct.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(dst, job->ct.data, job->ct.size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    /* pixels live in the buffer now */
+    gfx_cooked_drop_levels(&job->ct);
+
+    gfx_state_bind_texture(0, job->tx);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, n_mips - 1);
+    job->next_level = n_mips - 1;
+
+    /* may evict this very texture if nobody holds it, the job is cancelled then */
+    gfx_set_texture_bytes(job->tx, gfx_cooked_bytes(&job->ct));
+}
+
+static void gfx_stream_upload_next_level(gfx_stream_job_t *job)
+{
+    gfx_state_bind_texture(0, job->tx);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+    gfx_cooked_upload_level(&job->ct, job->next_level, NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job->next_level);
+    job->next_level--;
+}
+
+/* GL thread, once per frame. Each step is a whole level, so a step may overrun the budget */
+void gfx_stream_update(uint64_t budget_usec)
+{
+    uint64_t start = sys_get_time_usec();
+    gfx_stream_job_t *decoded;
+
+    sys_lock_mutex(stream.lock);
+    decoded = stream.decoded;
+    stream.decoded = NULL;
+    sys_unlock_mutex(stream.lock);
+
+    while (decoded) {
+        gfx_stream_job_t *job = decoded;
+        decoded = job->next;
+
+        job->next = NULL;
+        *stream.uploading_tail = job;
+        stream.uploading_tail = &job->next;
+    }
+
+    while (stream.uploading && sys_get_time_usec() - start < budget_usec) {
+        gfx_stream_job_t *job = stream.uploading;
+
+        if (!job->cancelled && job->ok) {
+            if (job->pbo == 0)
+                gfx_stream_stage(job);
+            else
+                gfx_stream_upload_next_level(job);
+
+            if (job->next_level >= 0)
+                continue;
+        }
+        else if (!job->ok) {
+            RENG_LOGF("TEXTURE NOT FOUND: %s", job->path);
+        }
+
+        stream.uploading = job->next;
+        if (stream.uploading == NULL)
+            stream.uploading_tail = &stream.uploading;
+
+        gfx_stream_free_job(job);
+    }
+}
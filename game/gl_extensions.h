@@ -28,5 +28,24 @@ GL_EXT_MACRO(glUniform1f, GLUNIFORM1F)
 GL_EXT_MACRO(glDeleteBuffers, GLDELETEBUFFERS)
 GL_EXT_MACRO(glDeleteVertexArrays, GLDELETEVERTEXARRAYS)
 GL_EXT_MACRO(glDeleteProgram, GLDELETEPROGRAM)
+GL_EXT_MACRO(glBufferSubData, GLBUFFERSUBDATA)
+GL_EXT_MACRO(glVertexAttribDivisor, GLVERTEXATTRIBDIVISOR)
+GL_EXT_MACRO(glDrawElementsInstanced, GLDRAWELEMENTSINSTANCED)
+GL_EXT_MACRO(glActiveTexture, GLACTIVETEXTURE)
+GL_EXT_MACRO(glMultiDrawElements, GLMULTIDRAWELEMENTS)
+GL_EXT_MACRO(glMapBufferRange, GLMAPBUFFERRANGE)
+GL_EXT_MACRO(glUnmapBuffer, GLUNMAPBUFFER)
+GL_EXT_MACRO(glGenFramebuffers, GLGENFRAMEBUFFERS)
+GL_EXT_MACRO(glDeleteFramebuffers, GLDELETEFRAMEBUFFERS)
+GL_EXT_MACRO(glBindFramebuffer, GLBINDFRAMEBUFFER)
+GL_EXT_MACRO(glFramebufferTexture2D, GLFRAMEBUFFERTEXTURE2D)
+GL_EXT_MACRO(glCheckFramebufferStatus, GLCHECKFRAMEBUFFERSTATUS)
+GL_EXT_MACRO(glBlitFramebuffer, GLBLITFRAMEBUFFER)
+GL_EXT_MACRO(glGenQueries, GLGENQUERIES)
+GL_EXT_MACRO(glDeleteQueries, GLDELETEQUERIES)
+GL_EXT_MACRO(glQueryCounter, GLQUERYCOUNTER)
+GL_EXT_MACRO(glGetQueryObjectiv, GLGETQUERYOBJECTIV)
+GL_EXT_MACRO(glGetQueryObjectui64v, GLGETQUERYOBJECTUI64V)
+GL_EXT_MACRO(glGetInteger64v, GLGETINTEGER64V)
 
 #undef GL_EXT_MACRO
\ No newline at end of file
@@ -9,6 +9,7 @@ unsigned int next_atomic_index;
 int rw_task;
 int rw_framename_index;
 int rdepth;
+const char *rw_txd;
 
 typedef struct rwclump {
     unsigned int num_atomics;
@@ -36,13 +37,20 @@ enum {
 #endif
 
 void geometry_destroy(geometry_t* g) {
+    gfx_state_forget_buffer(g->vbo);
+    gfx_state_forget_vao(g->vao);
     glwrapDeleteBuffers(1, &g->vbo);
+    glwrapDeleteBuffers(1, &g->ebo);
     glwrapDeleteVertexArrays(1, &g->vao);
 
-    for (unsigned int i = 0; i < g->n_draws; i++)
-        glwrapDeleteBuffers(1, &g->draws[i].ebo);
-
+    sys_free(g->range_counts);
+    sys_free(g->range_offsets);
     sys_free(g->draws);
+    for (uint32_t i = 0; i < g->n_materials; i++) {
+        if (g->materials[i].tx[0]) gfx_release_texture(g->materials[i].tx[0]);
+        if (g->materials[i].tx[1]) gfx_release_texture(g->materials[i].tx[1]);
+    }
+
     sys_free(g->materials);
 }
 
@@ -54,14 +62,100 @@ void dff_destroy(dff_t* dff)
     sys_free(dff->atomics);
     sys_free(dff->geometries);
     sys_free(dff->frames);
+    sys_free(dff->mvps);
 
     RENG_LOGF("DFF 0x%X Destroyed", dff);
 }
 
 void dff_read_entry(dff_t* dst, FILE *s);
 
-void dff_create_from_file(dff_t* data, FILE *s)
+static bool geometry_same_look(geometry_t* g, uint32_t a, uint32_t b)
+{
+    return g->materials[a].tx[0] == g->materials[b].tx[0] && g->materials[a].color == g->materials[b].color;
+}
+
+static bool geometry_draw_less(geometry_t* g, drawcall_t* a, drawcall_t* b)
+{
+    material_t* ma = &g->materials[a->material];
+    material_t* mb = &g->materials[b->material];
+
+    if (ma->tx[0] != mb->tx[0]) return ma->tx[0] < mb->tx[0];
+    return ma->color < mb->color;
+}
+
+/* 
+ * Textures are only known after the material list, so ranges are sorted here:
+ * by texture, then color, and neighbours with the same look share one multi-draw.
+ */
+static void geometry_sort_draws(geometry_t* g)
+{
+    GLsizei* counts = sys_malloc(g->n_ranges * sizeof(GLsizei));
+    const GLvoid** offsets = sys_malloc(g->n_ranges * sizeof(GLvoid*));
+    size_t n_draws = 0;
+
+    /* few materials per geometry, insertion sort is fine */
+    for (size_t i = 1; i < g->n_draws; i++) {
+        drawcall_t dc = g->draws[i];
+        size_t j = i;
+
+        for (; j > 0 && geometry_draw_less(g, &dc, &g->draws[j - 1]); j--)
+            g->draws[j] = g->draws[j - 1];
+        g->draws[j] = dc;
+    }
+
+    for (size_t i = 0; i < g->n_draws; i++) {
+        drawcall_t* dc = &g->draws[i];
+
+        counts[i] = g->range_counts[dc->first];
+        offsets[i] = g->range_offsets[dc->first];
+
+        if (n_draws > 0 && geometry_same_look(g, g->draws[n_draws - 1].material, dc->material)) {
+            g->draws[n_draws - 1].n_ranges++;
+        }
+        else {
+            g->draws[n_draws] = (drawcall_t) { .material = dc->material, .first = i, .n_ranges = 1 };
+            n_draws++;
+        }
+    }
+
+    sys_free(g->range_counts);
+    sys_free(g->range_offsets);
+    g->range_counts = counts;
+    g->range_offsets = offsets;
+    g->n_draws = n_draws;
+}
+
+static void dff_frame_matrix(dff_t* dff, uint32_t index, mat4* res)
+{
+    frame_t* f = &dff->frames[index];
+    mat4 local, parent;
+
+    mat4_translation(&parent, f->pos);
+    mat4_mul(&local, &parent, &f->rotation_mat);
+
+    if (f->index < dff->n_frames && f->index != index) {
+        dff_frame_matrix(dff, f->index, &parent);
+        mat4_mul(res, &parent, &local);
+    }
+    else *res = local;
+}
+
+/* records every atomic into the current layer, a dff is drawn at most once per submit */
+void dff_draw(dff_t* dff, mat4 *vp)
+{
+    for (size_t i = 0; i < dff->n_atomics; i++) {
+        atomic_t* a = &dff->atomics[i];
+        mat4 world;
+
+        dff_frame_matrix(dff, a->frame_index, &world);
+        mat4_mul(&dff->mvps[i], vp, &world);
+        gfx_push_geometry(&dff->geometries[a->geometry_index], &dff->mvps[i]);
+    }
+}
+
+void dff_create_from_file(dff_t* data, FILE *s, const char *txd)
 {
+    rw_txd = txd;
     cur_geometry_index = -1;
     next_atomic_index = 0;
     rw_task = RW_READING_NOTHING;
@@ -70,6 +164,10 @@ void dff_create_from_file(dff_t* data, FILE *s)
 
     *data = (dff_t) { 0 };
     dff_read_entry(data, s);
+
+    for (size_t i = 0; i < data->n_geometries; i++)
+        geometry_sort_draws(&data->geometries[i]);
+
     RW_PRINT("DFF DONE\n");
 }
 
@@ -114,10 +212,13 @@ void dff_read_frame_list(dff_t* dst, FILE *s)
     }
 }
 
+/* rw vertex indices are 16 bit */
 typedef struct ebo_triabgle {
-    GLint v[3];
+    GLushort v[3];
 } ebo_triangle_t;
 
+VECTOR_DEFINE(trivec, ebo_triangle_t, 4)
+
 enum {
     GEOM_TRI_STRIP = 0x1,
     GEOM_POSITIONS = 0x2,
@@ -160,14 +261,17 @@ void dff_read_geometry(dff_t *dst, FILE *s)
         n_uv_layers = (header.format & GEOM_TEXTURED) ? 1 : ((header.format & GEOM_TEXTURED2) ? 2 : 0);
     }
 
-    glvertex_t* verts = sys_malloc(header.num_vertices * sizeof(glvertex_t));
+    /* everything below is scratch, gone once the buffers are uploaded */
+    sys_arena_mark_t mark = sys_arena_mark(&sys_frame_arena);
+
+    glvertex_t* verts = sys_arena_alloc(&sys_frame_arena, header.num_vertices * sizeof(glvertex_t));
     for (size_t i = 0; i < header.num_vertices; i++)
         verts[i].color = VEC4F(1.f, 1.f, 1.f, 1.f);
 
-    vec2f** uv_maps = sys_malloc(n_uv_layers * sizeof(vec2f*));
+    vec2f** uv_maps = sys_arena_alloc(&sys_frame_arena, n_uv_layers * sizeof(vec2f*));
 
     size_t ebos_allocd = 0;
-    vector_t* ebos = NULL;
+    trivec_t* ebos = NULL;
 
     if ((header.format & GEOM_NATIVE) == 0) {
         if (header.format & GEOM_PRELIT) {
@@ -183,27 +287,35 @@ void dff_read_geometry(dff_t *dst, FILE *s)
         }
 
         for (size_t i = 0; i < n_uv_layers; i++) {
-            uv_maps[i] = sys_malloc(header.num_vertices * sizeof(vec2f));
+            uv_maps[i] = sys_arena_alloc(&sys_frame_arena, header.num_vertices * sizeof(vec2f));
             fread(uv_maps[i], 1, header.num_vertices * sizeof(vec2f), s);
         }
 
-        for (int i = 0; i < header.num_triangles; i++) {
-            rwtriangle_t tri;
-            fread(&tri, 1, sizeof(tri), s);
+        /* all triangles in one read, counted per material so every range is allocated once */
+        rwtriangle_t* tris = sys_arena_alloc(&sys_frame_arena, header.num_triangles * sizeof(rwtriangle_t));
+        fread(tris, 1, header.num_triangles * sizeof(rwtriangle_t), s);
 
-            if (ebos_allocd <= tri.material_id) {
-                ebos = sys_realloc(ebos, (tri.material_id + 1) * sizeof(vector_t));
+        for (uint32_t i = 0; i < header.num_triangles; i++)
+            ebos_allocd = max(ebos_allocd, (size_t)tris[i].material_id + 1);
 
-                for (size_t i = ebos_allocd; i <= tri.material_id; i++) {
-                    ebos[i] = vector_of(ebo_triangle_t);
-                }
-                ebos_allocd = tri.material_id + 1;
-            }
+        /* a zeroed trivec is empty, the array itself is scratch like the rest */
+        ebos = sys_arena_alloc(&sys_frame_arena, ebos_allocd * sizeof(trivec_t));
+        memset(ebos, 0, ebos_allocd * sizeof(trivec_t));
 
-            ebo_triangle_t* t = vector_emplace_back(&ebos[tri.material_id], ebo_triangle_t);
-            t->v[0] = tri.vertex1;
-            t->v[1] = tri.vertex2;
-            t->v[2] = tri.vertex3;
+        for (uint32_t i = 0; i < header.num_triangles; i++)
+            ebos[tris[i].material_id].size++;
+
+        for (size_t i = 0; i < ebos_allocd; i++) {
+            size_t n = ebos[i].size;
+            ebos[i].size = 0;
+            trivec_reserve(&ebos[i], n);
+        }
+
+        for (uint32_t i = 0; i < header.num_triangles; i++) {
+            ebo_triangle_t* t = trivec_emplace_back(&ebos[tris[i].material_id]);
+            t->v[0] = tris[i].vertex1;
+            t->v[1] = tris[i].vertex2;
+            t->v[2] = tris[i].vertex3;
         }
     }
 
@@ -234,11 +346,11 @@ void dff_read_geometry(dff_t *dst, FILE *s)
     }
 
     glwrapGenBuffers(1, &g->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, g->vbo);
+    gfx_state_bind_array_buffer(g->vbo);
     glBufferData(GL_ARRAY_BUFFER, header.num_vertices * sizeof(glvertex_t), verts, GL_STATIC_DRAW);
     
     glwrapGenVertexArrays(1, &g->vao);
-    glBindVertexArray(g->vao);
+    gfx_state_bind_vao(g->vao);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glvertex_t), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glvertex_t), (void*)(3 * sizeof(float)));
@@ -246,32 +358,51 @@ void dff_read_geometry(dff_t *dst, FILE *s)
     glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glvertex_t), (void*)(5 * sizeof(float)));
     glEnableVertexAttribArray(2);
 
-    g->n_draws = ebos_allocd;
+    /* one index buffer for all materials, each one gets a range of it */
+    size_t n_indices = 0;
+    g->n_ranges = 0;
+    for (size_t i = 0; i < ebos_allocd; i++) {
+        if (ebos[i].size) {
+            n_indices += 3 * ebos[i].size;
+            g->n_ranges++;
+        }
+    }
+
+    g->n_triangles = n_indices / 3;
+    g->n_draws = g->n_ranges;
     g->draws = sys_malloc(g->n_draws * sizeof(drawcall_t));
-    
-    for (int i = 0; i < ebos_allocd; i++) {
+    g->range_counts = sys_malloc(g->n_ranges * sizeof(GLsizei));
+    g->range_offsets = sys_malloc(g->n_ranges * sizeof(GLvoid*));
+
+    /* ranges are packed into one array first so the buffer is filled by a single upload */
+    ebo_triangle_t* all = sys_arena_alloc(&sys_frame_arena, g->n_triangles * sizeof(ebo_triangle_t));
+
+    size_t offset = 0;
+    size_t range = 0;
+    for (size_t i = 0; i < ebos_allocd; i++) {
         if (ebos[i].size) {
-            drawcall_t *dc = &g->draws[i];
-            
-            dc->n_verts = 3 * ebos[i].size;
+            size_t size = ebos[i].size * sizeof(ebo_triangle_t);
+
+            memcpy((char*)all + offset, trivec_data(&ebos[i]), size);
 
-            glwrapGenBuffers(1, &dc->ebo);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dc->ebo); 
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, dc->n_verts * sizeof(GLuint), ebos[i].data, GL_STATIC_DRAW);
+            g->range_counts[range] = 3 * ebos[i].size;
+            g->range_offsets[range] = (const GLvoid*)offset;
+            g->draws[range] = (drawcall_t) { .material = i, .first = range, .n_ranges = 1 };
+
+            offset += size;
+            range++;
         }
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0); 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    glwrapGenBuffers(1, &g->ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, n_indices * sizeof(GLushort), all, GL_STATIC_DRAW);
 
-    // Cleanup
-    for (size_t i = 0; i < n_uv_layers; i++) sys_free(uv_maps[i]);
-    for (size_t i = 0; i < ebos_allocd; i++) vector_destroy(&ebos[i]);
-    
-    sys_free(verts);
-    sys_free(uv_maps);
-    sys_free(ebos);
+    /* keep the element buffer attached to the vao */
+    gfx_state_bind_vao(0);
+
+    for (size_t i = 0; i < ebos_allocd; i++) trivec_destroy(&ebos[i]);
+    sys_arena_release(&sys_frame_arena, mark);
 }
 
 void dff_read_clump(dff_t* dst, FILE *s)
@@ -290,6 +421,7 @@ void dff_read_clump(dff_t* dst, FILE *s)
 
     dst->n_atomics = clump.n_atomics;
     dst->atomics = sys_malloc(clump.n_atomics * sizeof(atomic_t));
+    dst->mvps = sys_malloc(clump.n_atomics * sizeof(mat4));
 }
 
 void dff_read_geometry_list(dff_t *dst, FILE *s)
@@ -406,7 +538,8 @@ void dff_read_atomic(dff_t* dst, FILE *s)
 
 void dff_read_string(dff_t* dst, FILE *s, int len)
 {
-    char *str = (char*)sys_malloc(len);
+    sys_arena_mark_t mark = sys_arena_mark(&sys_frame_arena);
+    char *str = sys_arena_alloc(&sys_frame_arena, len);
     fread(str, 1, len, s);
 
     switch (rw_task) {
@@ -418,17 +551,27 @@ void dff_read_string(dff_t* dst, FILE *s, int len)
         {
             textureid_t *tx = &dst->geometries[cur_geometry_index].materials[cur_material_index].tx[++cur_texture_index];
             if (strlen(str) != 0) {
+                char buf[260];
                 str8 path;
-                str8_create_by_printf(&path, "%s.png", str);
+                asset_id_t id;
 
-                *tx = gfx_cache_texture(path.data, TEXTURE_LINEAR_FILTER);
-                RW_PRINTF("TEXTURE NAME '%s' %d\n", path.data, tx);
+                /* the full path, so reloads don't depend on the working directory */
+                str8_create_on_buffer(&path, buf, sizeof(buf));
+                str8_append(&path, "models/");
+                str8_append(&path, rw_txd);
+                str8_append(&path, "/");
+                str8_append(&path, str);
+                str8_append(&path, ".png");
+
+                id = asset_intern(path.data);
+                str8_destroy(&path);
+
+                *tx = gfx_cache_texture_async(id, TEXTURE_LINEAR_FILTER);
+                RW_PRINTF("TEXTURE NAME '%s' %d\n", asset_name(id), tx);
 
                 if (!tx) {
-                    RENG_LOGF("TEXTURE NOT FOUND: %s\n", path.data);
+                    RENG_LOGF("TEXTURE NOT FOUND: %s\n", str);
                 }
-
-                str8_destroy(&path);
             }
             else tx = 0;
             break;
@@ -437,7 +580,7 @@ void dff_read_string(dff_t* dst, FILE *s, int len)
             break;
     }
 
-    sys_free(str);
+    sys_arena_release(&sys_frame_arena, mark);
 }
 
 void dff_read_entry(dff_t *dst, FILE *s)
@@ -507,114 +650,3 @@ void dff_read_entry(dff_t *dst, FILE *s)
 
     rdepth--;
 }
-
-void rw_read_texture_dict(const char *name)
-{
-    WIN32_FIND_DATAA data;
-    HANDLE hFind;
-    str8 buf;
-    
-    SetCurrentDirectoryA("models");
-    str8_create_by_printf(&buf, "%s\\*", name);
-    hFind = FindFirstFileA(buf.data, &data);
-
-    SetCurrentDirectoryA(name);
-
-    if (hFind != INVALID_HANDLE_VALUE) {
-        do {
-            size_t len = strlen(data.cFileName);
-            if (len <= 4) continue;                 /* ".png" or less */
-
-            if (strcmp(data.cFileName + len - 4, ".png") == 0) {
-                gfx_cache_texture(data.cFileName, TEXTURE_LINEAR_FILTER);
-            }
-        } while (FindNextFileA(hFind, &data));
-       
-        FindClose(hFind);
-    }
-
-    str8_destroy(&buf);
-    SetCurrentDirectoryA("..");
-    SetCurrentDirectoryA("..");
-}
-
-// WTF IS THAT?? WORKS FOR NOW SO DONT TOUCH
-void rw_unload_texture_dict(const char *name)
-{
-    WIN32_FIND_DATAA data;
-    HANDLE hFind;
-    str8 buf;
-
-    SetCurrentDirectoryA("models");
-    str8_create_by_printf(&buf, "%s\\*", name);
-    hFind = FindFirstFileA(buf.data, &data);
-
-    SetCurrentDirectoryA(name);
-
-    if (hFind != INVALID_HANDLE_VALUE) {
-        do {
-            size_t len = strlen(data.cFileName);
-            if (len <= 4) continue;                 /* ".png" or less */
-
-            if (strcmp(data.cFileName + len - 4, ".png") == 0) {
-                gfx_uncache_texture(data.cFileName);
-            }
-        } while (FindNextFileA(hFind, &data));
-
-        FindClose(hFind);
-    }
-
-    str8_destroy(&buf);
-    SetCurrentDirectoryA("..");
-    SetCurrentDirectoryA("..");
-}
-
-typedef struct txdasset {
-    int used_cnt;
-} txdasset_t;
-
-hashtable_t txds;
-
-void rw_cache_texture_dict(const char *name)
-{
-    hashbucket_t *txd = hashtable_find(&txds, name);
-
-    if (txd) {
-        HASHBUCKET_DATA(txd, txdasset_t).used_cnt++;
-        return;
-    }
-
-    RENG_LOGF("Cached TXD %s", name);
-    rw_read_texture_dict(name);
-    HASHBUCKET_DATA(hashtable_emplace(&txds, name), txdasset_t).used_cnt = 1;
-}
-
-void rw_uncache_texture_dict(const char *name)
-{
-    hashbucket_t* txd = hashtable_find(&txds, name);
-    if (!txd) return;
-
-    HASHBUCKET_DATA(txd, txdasset_t).used_cnt--;
-    if (!HASHBUCKET_DATA(txd, txdasset_t).used_cnt) {
-        RENG_LOGF("Unached TXD %s", name);
-        rw_unload_texture_dict(name);
-        hashbucket_empty(txd);
-    }
-}
-
-void rw_init()
-{
-    txds = hashtable_of(txdasset_t);
-}
-
-void rw_deinit()
-{
-    for (int i = 0; i < txds.n_buckets * HT_SECTION_LEN; i++) {
-        hashbucket_t *b = hashtable_pick_bucket(&txds, i);
-        if (b->used) {
-            RENG_LOGF("Unloaded TXD: %s (used %d times)", b->name, HASHBUCKET_DATA(b, txdasset_t).used_cnt);
-        }
-    }
-
-    hashtable_destroy(&txds);
-}
\ No newline at end of file
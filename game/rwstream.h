@@ -18,16 +18,24 @@ typedef struct material {
     textureid_t tx[2];
 } material_t;
 
+/* one glMultiDrawElements over ranges [first, first + n_ranges) sharing a material look */
 typedef struct drawcall {
-    GLuint ebo;
-    size_t n_verts;
+    uint32_t material;
+    uint32_t first;
+    GLsizei n_ranges;
 } drawcall_t;
 
 typedef struct geometry {
     size_t n_triangles;
     GLuint vbo;
+    GLuint ebo;         /* indices of all materials back to back, part of vao state */
     GLuint vao;
 
+    /* per material index ranges, sorted by texture */
+    GLsizei*        range_counts;
+    const GLvoid**  range_offsets;
+    size_t          n_ranges;
+
     drawcall_t* draws;
     material_t* materials;
     size_t      n_draws;
@@ -55,6 +63,7 @@ typedef struct dff {
     atomic_t*   atomics;
     geometry_t* geometries;
     frame_t* frames;
+    mat4* mvps;         /* per atomic, written by dff_draw and read at gfx_submit */
     
     size_t n_atomics;
     size_t n_geometries;
@@ -63,13 +72,9 @@ typedef struct dff {
 
 #define EMPTY_DFF ((dff_t) { 0 } )
 
-void dff_create_from_file(dff_t* data, FILE *s);
+/* textures are models/<txd>/<name>.png */
+void dff_create_from_file(dff_t* data, FILE *s, const char *txd);
 void dff_destroy(dff_t* dff);
-
-void rw_cache_texture_dict(const char *name);
-void rw_uncache_texture_dict(const char *name);
-
-void rw_init();
-void rw_deinit();
+void dff_draw(dff_t* dff, mat4 *vp);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef RENG_SIMD_H
+#define RENG_SIMD_H
+
+/*
+ * Four float lanes over whatever the target has: SSE on x86, NEON on ARM,
+ * plain structs elsewhere so the kernels still build. Only what exmath
+ * and particle kernels need is here. Loads and stores are unaligned.
+ */
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define SIMD_SSE 1
+    #include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+    #define SIMD_NEON 1
+    #include <arm_neon.h>
+#endif
+
+/* functions using AVX2/FMA intrinsics, MSVC allows them anywhere */
+#if defined(SIMD_SSE) && (defined(__GNUC__) || defined(__clang__))
+    #define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+    #define SIMD_TARGET_AVX2
+#endif
+
+#if defined(SIMD_SSE)
+
+typedef __m128 simd4f;
+
+static inline simd4f simd4f_load(const float *p)                { return _mm_loadu_ps(p); }
+static inline void   simd4f_store(float *p, simd4f a)           { _mm_storeu_ps(p, a); }
+static inline simd4f simd4f_splat(float a)                      { return _mm_set1_ps(a); }
+static inline simd4f simd4f_set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+static inline simd4f simd4f_add(simd4f a, simd4f b)             { return _mm_add_ps(a, b); }
+static inline simd4f simd4f_sub(simd4f a, simd4f b)             { return _mm_sub_ps(a, b); }
+static inline simd4f simd4f_mul(simd4f a, simd4f b)             { return _mm_mul_ps(a, b); }
+static inline simd4f simd4f_div(simd4f a, simd4f b)             { return _mm_div_ps(a, b); }
+static inline simd4f simd4f_madd(simd4f a, simd4f b, simd4f c)  { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline simd4f simd4f_max(simd4f a, simd4f b)             { return _mm_max_ps(a, b); }
+
+/* to nearest, ties to even, |a| < 2^31 */
+static inline simd4f simd4f_round(simd4f a)                     { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+
+/* x0 x0 x1 x1 and y0 y0 y1 y1 of two interleaved vec2f */
+static inline simd4f simd4f_dup_even(simd4f a)                  { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 0, 0)); }
+static inline simd4f simd4f_dup_odd(simd4f a)                   { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 1, 1)); }
+
+#define simd4f_lane(a, i) _mm_shuffle_ps((a), (a), _MM_SHUFFLE(i, i, i, i))
+
+#elif defined(SIMD_NEON)
+
+typedef float32x4_t simd4f;
+
+static inline simd4f simd4f_load(const float *p)                { return vld1q_f32(p); }
+static inline void   simd4f_store(float *p, simd4f a)           { vst1q_f32(p, a); }
+static inline simd4f simd4f_splat(float a)                      { return vdupq_n_f32(a); }
+static inline simd4f simd4f_set(float x, float y, float z, float w) { float v[4] = { x, y, z, w }; return vld1q_f32(v); }
+static inline simd4f simd4f_add(simd4f a, simd4f b)             { return vaddq_f32(a, b); }
+static inline simd4f simd4f_sub(simd4f a, simd4f b)             { return vsubq_f32(a, b); }
+static inline simd4f simd4f_mul(simd4f a, simd4f b)             { return vmulq_f32(a, b); }
+static inline simd4f simd4f_div(simd4f a, simd4f b)             { return vdivq_f32(a, b); }
+static inline simd4f simd4f_madd(simd4f a, simd4f b, simd4f c)  { return vfmaq_f32(c, a, b); }
+static inline simd4f simd4f_max(simd4f a, simd4f b)             { return vmaxq_f32(a, b); }
+static inline simd4f simd4f_round(simd4f a)                     { return vrndnq_f32(a); }
+
+static inline simd4f simd4f_dup_even(simd4f a)                  { return vtrn1q_f32(a, a); }
+static inline simd4f simd4f_dup_odd(simd4f a)                   { return vtrn2q_f32(a, a); }
+
+#define simd4f_lane(a, i) vdupq_laneq_f32((a), (i))
+
+#else
+
+#include <math.h>
+
+typedef struct simd4f { float v[4]; } simd4f;
+
+static inline simd4f simd4f_load(const float *p)                { simd4f r = { { p[0], p[1], p[2], p[3] } }; return r; }
+static inline void   simd4f_store(float *p, simd4f a)           { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2]; p[3] = a.v[3]; }
+static inline simd4f simd4f_splat(float a)                      { simd4f r = { { a, a, a, a } }; return r; }
+static inline simd4f simd4f_set(float x, float y, float z, float w) { simd4f r = { { x, y, z, w } }; return r; }
+static inline simd4f simd4f_add(simd4f a, simd4f b)             { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+static inline simd4f simd4f_sub(simd4f a, simd4f b)             { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+static inline simd4f simd4f_mul(simd4f a, simd4f b)             { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+static inline simd4f simd4f_div(simd4f a, simd4f b)             { for (int i = 0; i < 4; i++) a.v[i] /= b.v[i]; return a; }
+static inline simd4f simd4f_madd(simd4f a, simd4f b, simd4f c)  { for (int i = 0; i < 4; i++) c.v[i] += a.v[i] * b.v[i]; return c; }
+static inline simd4f simd4f_max(simd4f a, simd4f b)             { for (int i = 0; i < 4; i++) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+static inline simd4f simd4f_round(simd4f a)                     { for (int i = 0; i < 4; i++) a.v[i] = nearbyintf(a.v[i]); return a; }
+
+static inline simd4f simd4f_dup_even(simd4f a)                  { return simd4f_set(a.v[0], a.v[0], a.v[2], a.v[2]); }
+static inline simd4f simd4f_dup_odd(simd4f a)                   { return simd4f_set(a.v[1], a.v[1], a.v[3], a.v[3]); }
+
+#define simd4f_lane(a, i) simd4f_splat((a).v[i])
+
+#endif
+
+#endif
@@ -8,6 +8,9 @@
     void *sys_internal_malloc(size_t size, const char *file, int line);
     void  sys_internal_free(void *ptr, const char *file, int line);
     void *sys_internal_realloc(void *ptr, size_t size, const char *file, int line); 
+    void *sys_internal_aligned_malloc(size_t size, size_t alignment, const char *file, int line);
+    void  sys_internal_aligned_free(void *ptr, const char *file, int line);
+    uint64_t sys_memtrace_heap_calls();
 
     void gl_internal_gen_buffers(GLsizei n, GLuint *ptr, const char *file, int line);
     void gl_internal_gen_textures(GLsizei n, GLuint *ptr, const char *file, int line);
@@ -20,6 +23,8 @@
     #define sys_malloc(sz)                  sys_internal_malloc(sz, __FILE__, __LINE__)
     #define sys_free(p)                     sys_internal_free(p, __FILE__, __LINE__)
     #define sys_realloc(p, sz)              sys_internal_realloc(p, sz, __FILE__, __LINE__)
+    #define sys_aligned_malloc(sz, al)      sys_internal_aligned_malloc(sz, al, __FILE__, __LINE__)
+    #define sys_aligned_free(p)             sys_internal_aligned_free(p, __FILE__, __LINE__)
 
     #define glwrapGenBuffers(n, ptr)           gl_internal_gen_buffers(n, ptr, __FILE__, __LINE__)
     #define glwrapGenTextures(n, ptr)          gl_internal_gen_textures(n, ptr, __FILE__, __LINE__)
@@ -32,6 +37,8 @@
     #define sys_malloc   malloc
     #define sys_free     free
     #define sys_realloc  realloc
+    #define sys_aligned_malloc  _aligned_malloc
+    #define sys_aligned_free    _aligned_free
 
     #define glwrapGenBuffers glGenBuffers
     #define glwrapGenTextures glGenTextures
@@ -70,6 +77,59 @@ typedef enum {
 
 typedef uintmax_t file_handle_t;
 
+typedef struct sys_thread sys_thread_t;
+typedef struct sys_mutex sys_mutex_t;
+typedef struct sys_semaphore sys_semaphore_t;
+typedef int (*sys_thread_fn)(void *arg);
+
+/*
+ * Bump allocator for short lived data. Allocations are 16 byte aligned and
+ * only go away all at once, on reset or by releasing back to a mark taken
+ * at the start of a scope. Chunks are kept, and a reset that finds more than
+ * one merges them, so a repeating workload stops touching the heap.
+ */
+typedef struct sys_arena_chunk sys_arena_chunk_t;
+
+typedef struct sys_arena {
+    sys_arena_chunk_t *chunk;   /* newest, older ones through chunk->prev */
+    size_t used;                /* of chunk */
+    size_t chunk_size;          /* smallest chunk to allocate */
+    size_t allocated;           /* since the last reset */
+    size_t peak;
+} sys_arena_t;
+
+typedef struct sys_arena_mark {
+    sys_arena_chunk_t *chunk;
+    size_t used;
+    size_t allocated;
+} sys_arena_mark_t;
+
+#define SYS_FRAME_ARENA_SIZE (64 * 1024)
+
+/* reset before every frame, main thread only */
+extern sys_arena_t sys_frame_arena;
+
+/*
+ * Size class allocator for small objects that come and go. Each class cuts
+ * objects from slabs of SYS_POOL_SLAB_SIZE pages and every thread keeps a
+ * short free list per class, exchanged with the shared one in batches, so
+ * most calls take no lock. Bigger requests get pages of their own. Memory
+ * from sys_pool_alloc goes back to sys_pool_free only, from any thread.
+ * Threads from sys_create_thread flush their lists when they exit, others
+ * have to call sys_pool_flush_thread themselves.
+ * Counters are kept per class rather than per allocation.
+ */
+#define SYS_POOL_SLAB_SIZE (64 * 1024)
+#define SYS_POOL_MAX_SIZE 1024
+#define SYS_POOL_N_CLASSES 12
+
+typedef struct sys_pool_stats {
+    uint32_t size;              /* of an object, 0 for the large allocations */
+    uint32_t n_slabs;
+    uint64_t n_allocs;
+    uint64_t n_frees;
+} sys_pool_stats_t;
+
 extern sys_common_t sys;
 
 int             sys_is_key_pressed(int key);
@@ -84,6 +144,43 @@ size_t          sys_read_file(file_handle_t file, void *dst, size_t bytes);
 size_t          sys_get_file_pos(file_handle_t file);
 void            sys_set_file_pos(file_handle_t file, size_t offset, FILEPOS type);
 
+/* non-fatal variants, for caches that may be missing or read-only */
+file_handle_t   sys_try_open_file(const char* name, const char* openflags);
+size_t          sys_write_file(file_handle_t file, const void *src, size_t bytes);
+bool            sys_get_file_info(const char* name, uint64_t *mtime, uint64_t *size);
+bool            sys_replace_file(const char* src, const char* dst);
+void*           sys_map_file(const char* name, size_t *size);
+void            sys_unmap_file(void *data, size_t size);
+
+uint64_t        sys_get_time_usec();
+sys_thread_t*   sys_create_thread(sys_thread_fn fn, void *arg);
+void            sys_join_thread(sys_thread_t *thread);
+sys_mutex_t*    sys_create_mutex();
+void            sys_destroy_mutex(sys_mutex_t *mutex);
+void            sys_lock_mutex(sys_mutex_t *mutex);
+void            sys_unlock_mutex(sys_mutex_t *mutex);
+sys_semaphore_t* sys_create_semaphore(int initial);
+void            sys_destroy_semaphore(sys_semaphore_t *sem);
+void            sys_wait_semaphore(sys_semaphore_t *sem);
+void            sys_post_semaphore(sys_semaphore_t *sem, int count);
+
+void*           sys_arena_alloc(sys_arena_t *arena, size_t size);
+sys_arena_mark_t sys_arena_mark(sys_arena_t *arena);
+void            sys_arena_release(sys_arena_t *arena, sys_arena_mark_t mark);
+void            sys_arena_reset(sys_arena_t *arena);
+void            sys_arena_destroy(sys_arena_t *arena);
+
+void            sys_pool_init();
+void            sys_pool_deinit();
+void*           sys_pool_alloc(size_t size);
+void            sys_pool_free(void *ptr);
+void            sys_pool_flush_thread();
+void            sys_pool_get_stats(sys_pool_stats_t stats[SYS_POOL_N_CLASSES + 1]);
+
+/* zeroed, aligned to SYS_POOL_SLAB_SIZE */
+void*           sys_alloc_pages(size_t size);
+void            sys_free_pages(void *ptr);
+
 #ifdef RENG_ENABLE_LOG
     void sys_logf(const char *fmt, const char *file, int line, ...);
     void sys_log(const char *str, const char *file, int line);
@@ -0,0 +1,91 @@
+#include "def.h"
+
+#include "sys.h"
+
+struct sys_arena_chunk {
+    sys_arena_chunk_t *prev;
+    size_t size;                /* of data */
+};
+
+/* data starts right after the header, keeping its alignment */
+#define SYS_ARENA_ALIGN 16
+#define SYS_ARENA_HEADER ((sizeof(sys_arena_chunk_t) + SYS_ARENA_ALIGN - 1) & ~(size_t)(SYS_ARENA_ALIGN - 1))
+#define SYS_ARENA_DATA(chunk) ((char*)(chunk) + SYS_ARENA_HEADER)
+
+sys_arena_t sys_frame_arena = { .chunk_size = SYS_FRAME_ARENA_SIZE };
+
+static void sys_arena_push_chunk(sys_arena_t *arena, size_t size)
+{
+    sys_arena_chunk_t *chunk = sys_aligned_malloc(SYS_ARENA_HEADER + size, SYS_ARENA_ALIGN);
+
+    chunk->prev = arena->chunk;
+    chunk->size = size;
+    arena->chunk = chunk;
+    arena->used = 0;
+}
+
+static void sys_arena_pop_chunk(sys_arena_t *arena)
+{
+    sys_arena_chunk_t *chunk = arena->chunk;
+
+    arena->chunk = chunk->prev;
+    arena->used = arena->chunk ? arena->chunk->size : 0;
+    sys_aligned_free(chunk);
+}
+
+void* sys_arena_alloc(sys_arena_t *arena, size_t size)
+{
+    void *res;
+
+    size = (size + SYS_ARENA_ALIGN - 1) & ~(size_t)(SYS_ARENA_ALIGN - 1);
+
+    if (arena->chunk == NULL || arena->used + size > arena->chunk->size)
+        sys_arena_push_chunk(arena, max(size, arena->chunk_size));
+
+    res = SYS_ARENA_DATA(arena->chunk) + arena->used;
+    arena->used += size;
+    arena->allocated += size;
+    arena->peak = max(arena->peak, arena->allocated);
+    return res;
+}
+
+sys_arena_mark_t sys_arena_mark(sys_arena_t *arena)
+{
+    return (sys_arena_mark_t) { arena->chunk, arena->used, arena->allocated };
+}
+
+/* chunks pushed after the mark are freed, except the first one of the arena */
+void sys_arena_release(sys_arena_t *arena, sys_arena_mark_t mark)
+{
+    while (arena->chunk != mark.chunk && (mark.chunk || arena->chunk->prev))
+        sys_arena_pop_chunk(arena);
+
+    arena->used = mark.used;
+    arena->allocated = mark.allocated;
+}
+
+void sys_arena_reset(sys_arena_t *arena)
+{
+    size_t total = 0;
+
+    if (arena->chunk && arena->chunk->prev) {
+        while (arena->chunk) {
+            total += arena->chunk->size;
+            sys_arena_pop_chunk(arena);
+        }
+
+        sys_arena_push_chunk(arena, total);
+    }
+
+    arena->used = 0;
+    arena->allocated = 0;
+}
+
+void sys_arena_destroy(sys_arena_t *arena)
+{
+    while (arena->chunk)
+        sys_arena_pop_chunk(arena);
+
+    arena->used = 0;
+    arena->allocated = 0;
+}
@@ -0,0 +1,245 @@
+#include "def.h"
+
+#include "sys.h"
+
+#ifdef _MSC_VER
+    #define SYS_THREAD_LOCAL __declspec(thread)
+#else
+    #define SYS_THREAD_LOCAL _Thread_local
+#endif
+
+/*
+ * Slabs are aligned to their size, so the header of the slab an object came
+ * from is found by masking its address. Objects start after the header.
+ */
+typedef struct sys_pool_slab {
+    struct sys_pool_slab *next;     /* every class slab, for deinit */
+    uint32_t class_index;           /* SYS_POOL_N_CLASSES for large ones */
+} sys_pool_slab_t;
+
+#define SYS_POOL_HEADER 64
+
+typedef struct sys_pool_object {
+    struct sys_pool_object *next;
+} sys_pool_object_t;
+
+typedef struct sys_pool_class {
+    uint32_t batch;                 /* objects moved between a thread and the class at once */
+    sys_pool_object_t *free;        /* under lock */
+    sys_pool_stats_t stats;         /* under lock */
+} sys_pool_class_t;
+
+typedef struct sys_pool_cache {
+    sys_pool_object_t *free;
+    uint32_t count;
+    uint64_t n_allocs, n_frees;     /* not yet added to the class stats */
+} sys_pool_cache_t;
+
+static const uint32_t class_sizes[SYS_POOL_N_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+
+static sys_pool_class_t classes[SYS_POOL_N_CLASSES];
+static sys_pool_stats_t large_stats;
+static uint8_t class_of[SYS_POOL_MAX_SIZE / 16 + 1];     /* by size in 16 byte steps */
+static sys_pool_slab_t *slabs;
+static sys_mutex_t *lock;
+
+static SYS_THREAD_LOCAL sys_pool_cache_t caches[SYS_POOL_N_CLASSES];
+
+void sys_pool_init()
+{
+    uint32_t c = 0;
+
+    for (uint32_t i = 0; i <= SYS_POOL_MAX_SIZE / 16; i++) {
+        while (class_sizes[c] < i * 16)
+            c++;
+        class_of[i] = (uint8_t)c;
+    }
+
+    for (uint32_t i = 0; i < SYS_POOL_N_CLASSES; i++) {
+        classes[i].batch = min(max(8192 / class_sizes[i], 4), 64);
+        classes[i].stats.size = class_sizes[i];
+    }
+
+    lock = sys_create_mutex();
+}
+
+/* lock held */
+static void sys_pool_fold_stats(uint32_t c)
+{
+    classes[c].stats.n_allocs += caches[c].n_allocs;
+    classes[c].stats.n_frees += caches[c].n_frees;
+    caches[c].n_allocs = caches[c].n_frees = 0;
+}
+
+/* lock held, the whole slab goes onto the class list */
+static void sys_pool_add_slab(uint32_t c)
+{
+    sys_pool_slab_t *slab = sys_alloc_pages(SYS_POOL_SLAB_SIZE);
+    uint32_t size = class_sizes[c];
+    char *first = (char*)slab + SYS_POOL_HEADER;
+    uint32_t n = (SYS_POOL_SLAB_SIZE - SYS_POOL_HEADER) / size;
+
+    slab->next = slabs;
+    slab->class_index = c;
+    slabs = slab;
+
+    for (uint32_t i = n; i-- > 0;) {
+        sys_pool_object_t *obj = (sys_pool_object_t*)(first + i * size);
+        obj->next = classes[c].free;
+        classes[c].free = obj;
+    }
+
+    classes[c].stats.n_slabs++;
+}
+
+static void sys_pool_refill(uint32_t c)
+{
+    sys_pool_cache_t *cache = &caches[c];
+
+    sys_lock_mutex(lock);
+    sys_pool_fold_stats(c);
+
+    for (uint32_t i = 0; i < classes[c].batch; i++) {
+        sys_pool_object_t *obj;
+
+        if (classes[c].free == NULL)
+            sys_pool_add_slab(c);
+
+        obj = classes[c].free;
+        classes[c].free = obj->next;
+        obj->next = cache->free;
+        cache->free = obj;
+        cache->count++;
+    }
+
+    sys_unlock_mutex(lock);
+}
+
+/* gives back n objects of the thread cache, all of them when n is the count */
+static void sys_pool_drain(uint32_t c, uint32_t n)
+{
+    sys_pool_cache_t *cache = &caches[c];
+
+    sys_lock_mutex(lock);
+    sys_pool_fold_stats(c);
+
+    for (uint32_t i = 0; i < n; i++) {
+        sys_pool_object_t *obj = cache->free;
+        cache->free = obj->next;
+        obj->next = classes[c].free;
+        classes[c].free = obj;
+    }
+
+    cache->count -= n;
+    sys_unlock_mutex(lock);
+}
+
+static void* sys_pool_alloc_large(size_t size)
+{
+    size_t pages = (SYS_POOL_HEADER + size + SYS_POOL_SLAB_SIZE - 1) & ~(size_t)(SYS_POOL_SLAB_SIZE - 1);
+    sys_pool_slab_t *slab = sys_alloc_pages(pages);
+
+    slab->class_index = SYS_POOL_N_CLASSES;
+
+    sys_lock_mutex(lock);
+    large_stats.n_allocs++;
+    large_stats.n_slabs++;
+    sys_unlock_mutex(lock);
+
+    return (char*)slab + SYS_POOL_HEADER;
+}
+
+void* sys_pool_alloc(size_t size)
+{
+    sys_pool_cache_t *cache;
+    sys_pool_object_t *obj;
+    uint32_t c;
+
+    if (size > SYS_POOL_MAX_SIZE)
+        return sys_pool_alloc_large(size);
+
+    c = class_of[(size + 15) >> 4];
+    cache = &caches[c];
+
+    if (cache->free == NULL)
+        sys_pool_refill(c);
+
+    obj = cache->free;
+    cache->free = obj->next;
+    cache->count--;
+    cache->n_allocs++;
+    return obj;
+}
+
+void sys_pool_free(void *ptr)
+{
+    sys_pool_slab_t *slab = (sys_pool_slab_t*)((uintptr_t)ptr & ~(uintptr_t)(SYS_POOL_SLAB_SIZE - 1));
+    sys_pool_object_t *obj = ptr;
+    sys_pool_cache_t *cache;
+    uint32_t c;
+
+    if (ptr == NULL)
+        return;
+
+    c = slab->class_index;
+
+    if (c == SYS_POOL_N_CLASSES) {
+        sys_lock_mutex(lock);
+        large_stats.n_frees++;
+        large_stats.n_slabs--;
+        sys_unlock_mutex(lock);
+
+        sys_free_pages(slab);
+        return;
+    }
+
+    cache = &caches[c];
+    obj->next = cache->free;
+    cache->free = obj;
+    cache->count++;
+    cache->n_frees++;
+
+    /* keep one batch around so alloc/free pairs at the edge don't hit the lock */
+    if (cache->count >= 2 * classes[c].batch)
+        sys_pool_drain(c, classes[c].batch);
+}
+
+/* gives the thread's lists back, or their objects are lost when it exits */
+void sys_pool_flush_thread()
+{
+    for (uint32_t c = 0; c < SYS_POOL_N_CLASSES; c++)
+        sys_pool_drain(c, caches[c].count);
+}
+
+/* counters of other threads are included up to their last exchange with the class */
+void sys_pool_get_stats(sys_pool_stats_t stats[SYS_POOL_N_CLASSES + 1])
+{
+    sys_lock_mutex(lock);
+
+    for (uint32_t c = 0; c < SYS_POOL_N_CLASSES; c++) {
+        sys_pool_fold_stats(c);
+        stats[c] = classes[c].stats;
+    }
+
+    stats[SYS_POOL_N_CLASSES] = large_stats;
+    sys_unlock_mutex(lock);
+}
+
+/* objects still allocated are gone too, large ones are left alone */
+void sys_pool_deinit()
+{
+    while (slabs) {
+        sys_pool_slab_t *next = slabs->next;
+        sys_free_pages(slabs);
+        slabs = next;
+    }
+
+    memset(classes, 0, sizeof(classes));
+    memset(caches, 0, sizeof(caches));
+    memset(&large_stats, 0, sizeof(large_stats));
+
+    sys_destroy_mutex(lock);
+    lock = NULL;
+}
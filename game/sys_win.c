@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <hidusage.h>
 #include <stdarg.h>
+#include <string.h>
 #include <winnt.h>
 #include <psapi.h>
 
@@ -21,6 +22,7 @@
 #include "entity.h"
 #include "utils.h"
 #include "rwstream.h"
+#include "bench.h"
 
 typedef struct {
     HWND hwnd;
@@ -89,10 +91,12 @@ alloc_info_t recentmem[ALLOCSTACK_SIZE];
 
 uint64_t n_allocs, n_reallocs, n_frees;
 
-void *sys_internal_malloc(size_t size, const char *file, int line)
+/* texture workers allocate too, recentmem is shared. recursive, realloc calls malloc */
+CRITICAL_SECTION memlock;
+
+/* takes the oldest recentmem slot, call with memlock held */
+static void sys_trace_alloc(void *ptr, const char *file, int line)
 {
-    n_allocs++;
-        
     uint64_t min_time = recentmem[0].time;
     int min_i = 0;
     
@@ -106,19 +110,86 @@ void *sys_internal_malloc(size_t size, const char *file, int line)
     if (min_time)
         fprintf(memfile, "M %llu %s %d\n", recentmem[min_i].ptr, recentmem[min_i].file, recentmem[min_i].line);
 
-    recentmem[min_i].ptr = malloc(size);
+    recentmem[min_i].ptr = ptr;
     recentmem[min_i].time = time(NULL);
     recentmem[min_i].file = file;
     recentmem[min_i].line = line;
-    return recentmem[min_i].ptr;
+}
+
+/* call with memlock held */
+static void sys_trace_free(void *mem, const char *file, int line)
+{
+    for (int i = 0; i < ALLOCSTACK_SIZE; i++) {
+        if (recentmem[i].ptr == mem) {
+            recentmem[i].ptr = NULL;
+            recentmem[i].time = 0;
+            goto skip;
+        }
+    }
+
+    fprintf(memfile, "F %llu %s %d\n", mem, file, line);
+
+skip:
+    n_frees++;
+}
+
+void *sys_internal_malloc(size_t size, const char *file, int line)
+{
+    void *res;
+
+    EnterCriticalSection(&memlock);
+    n_allocs++;
+    res = malloc(size);
+    sys_trace_alloc(res, file, line);
+    LeaveCriticalSection(&memlock);
+    return res;
+}
+
+/* for blocks read with aligned SIMD loads, the CRT malloc only promises 8 bytes on x86 */
+void *sys_internal_aligned_malloc(size_t size, size_t alignment, const char *file, int line)
+{
+    void *res;
+
+    EnterCriticalSection(&memlock);
+    n_allocs++;
+    res = _aligned_malloc(size, alignment);
+    sys_trace_alloc(res, file, line);
+    LeaveCriticalSection(&memlock);
+    return res;
+}
+
+void sys_internal_aligned_free(void *mem, const char *file, int line)
+{
+    if (mem) {
+        EnterCriticalSection(&memlock);
+        sys_trace_free(mem, file, line);
+        _aligned_free(mem);
+        LeaveCriticalSection(&memlock);
+    }
+}
+
+/* mallocs and reallocs so far, see bench_run */
+uint64_t sys_memtrace_heap_calls()
+{
+    uint64_t n;
+
+    EnterCriticalSection(&memlock);
+    n = n_allocs + n_reallocs;
+    LeaveCriticalSection(&memlock);
+    return n;
 }
 
 void *sys_internal_realloc(void *mem, size_t newsize, const char *file, int line)
 {
+    void *res;
+
+    EnterCriticalSection(&memlock);
     n_reallocs++;
     if (!mem) {
         n_allocs--;
-        return sys_internal_malloc(newsize, file, line);
+        res = sys_internal_malloc(newsize, file, line);
+        LeaveCriticalSection(&memlock);
+        return res;
     }
     else {
         for (int i = 0; i < ALLOCSTACK_SIZE; i++) {
@@ -127,12 +198,16 @@ void *sys_internal_realloc(void *mem, size_t newsize, const char *file, int line
                 recentmem[i].line = line;
                 recentmem[i].ptr = realloc(mem, newsize);
                 recentmem[i].time = time(NULL);
-                return recentmem[i].ptr;
+
+                res = recentmem[i].ptr;
+                LeaveCriticalSection(&memlock);
+                return res;
             }
         }
 
-        void *res = realloc(mem, newsize);
+        res = realloc(mem, newsize);
         fprintf(memfile, "R %llu %llu %s %d\n", res, mem, file, line);
+        LeaveCriticalSection(&memlock);
         return res;
     }
 }
@@ -140,19 +215,10 @@ void *sys_internal_realloc(void *mem, size_t newsize, const char *file, int line
 void sys_internal_free(void *mem, const char *file, int line)
 {
     if (mem) {
-        for (int i = 0; i < ALLOCSTACK_SIZE; i++) {
-            if (recentmem[i].ptr == mem) {
-                recentmem[i].ptr = NULL;
-                recentmem[i].time = 0;
-                goto skip;
-            }
-        }
-
-        fprintf(memfile, "F %llu %s %d\n", mem, file, line);
-
-    skip:
-        n_frees++;
+        EnterCriticalSection(&memlock);
+        sys_trace_free(mem, file, line);
         free(mem);
+        LeaveCriticalSection(&memlock);
     }
 }
 
@@ -264,13 +330,14 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
         case WM_PAINT:
             {
-                glViewport(0, 0, sys.width, sys.height);
-                glMatrixMode(GL_PROJECTION);
-                glLoadIdentity();
+                gfx_state_set_viewport(0, 0, sys.width, sys.height);
 
                 PAINTSTRUCT ps;
                 BeginPaint(hwnd, &ps);
+                sys_arena_reset(&sys_frame_arena);
+                gfx_begin_frame();
                 game_draw();
+                gfx_end_frame();
                 EndPaint(hwnd, &ps);
             }
             ValidateRect(hwnd, NULL);
@@ -288,13 +355,23 @@ int64_t GetTime()
     return GetTickCount64();
 }
 
+/* WGL_ARB_create_context, not in the glext.h we ship */
+#define WGL_CONTEXT_MAJOR_VERSION_ARB               0x2091
+#define WGL_CONTEXT_MINOR_VERSION_ARB               0x2092
+#define WGL_CONTEXT_FLAGS_ARB                       0x2094
+#define WGL_CONTEXT_PROFILE_MASK_ARB                0x9126
+#define WGL_CONTEXT_FORWARD_COMPATIBLE_BIT_ARB      0x0002
+#define WGL_CONTEXT_CORE_PROFILE_BIT_ARB            0x00000001
+
+typedef HGLRC (WINAPI *PFNWGLCREATECONTEXTATTRIBSARBPROC)(HDC hdc, HGLRC share, const int *attribs);
+
 void attach_gl()
 {
     PIXELFORMATDESCRIPTOR descriptor;
 
     descriptor.nSize = sizeof(descriptor);
     descriptor.nVersion = 1;
-    descriptor.dwFlags = PFD_DRAW_TO_WINDOW | PFD_DRAW_TO_BITMAP | PFD_SUPPORT_OPENGL | PFD_GENERIC_ACCELERATED | PFD_DOUBLEBUFFER | PFD_SWAP_LAYER_BUFFERS;
+    descriptor.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
     descriptor.iPixelType = PFD_TYPE_RGBA;
     descriptor.cColorBits = 32;
     descriptor.cRedBits = 8;
@@ -307,8 +384,30 @@ void attach_gl()
     int pixel_format = ChoosePixelFormat(winapi.hdc, &descriptor);
     SetPixelFormat(winapi.hdc, pixel_format, &descriptor);
 
-    HGLRC glcontext = wglCreateContext(winapi.hdc);
-    wglMakeCurrent(winapi.hdc, glcontext);
+    /* a legacy context is needed just to get wglCreateContextAttribsARB */
+    HGLRC dummy = wglCreateContext(winapi.hdc);
+    wglMakeCurrent(winapi.hdc, dummy);
+
+    PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB =
+        (PFNWGLCREATECONTEXTATTRIBSARBPROC)wglGetProcAddress("wglCreateContextAttribsARB");
+
+    static const int attribs[] = {
+        WGL_CONTEXT_MAJOR_VERSION_ARB, 3,
+        WGL_CONTEXT_MINOR_VERSION_ARB, 3,
+        WGL_CONTEXT_PROFILE_MASK_ARB, WGL_CONTEXT_CORE_PROFILE_BIT_ARB,
+        WGL_CONTEXT_FLAGS_ARB, WGL_CONTEXT_FORWARD_COMPATIBLE_BIT_ARB,
+        0
+    };
+
+    if (wglCreateContextAttribsARB == NULL)
+        sys_fatal_error("wglCreateContextAttribsARB is not supported");
+
+    winapi.glcontext = wglCreateContextAttribsARB(winapi.hdc, NULL, attribs);
+    if (winapi.glcontext == NULL)
+        sys_fatal_error("Failed to create OpenGL 3.3 core profile context");
+
+    wglMakeCurrent(winapi.hdc, winapi.glcontext);
+    wglDeleteContext(dummy);
 }
 
 int sys_is_key_pressed(int key)
@@ -377,14 +476,203 @@ void sys_set_file_pos(file_handle_t file, size_t offset, FILEPOS type)
     fseek(file, offset, map[type]);
 }
 
+/* returns 0 on failure */
+file_handle_t sys_try_open_file(const char* name, const char* openflags)
+{
+    file_handle_t res;
+    if (fopen_s(&res, name, openflags) != 0)
+        return 0;
+    return res;
+}
 
-int main()
+size_t sys_write_file(file_handle_t file, const void* src, size_t bytes)
 {
+    return fwrite(src, 1, bytes, file);
+}
+
+/* moves src over dst in one step, readers see either the old file or the new one */
+bool sys_replace_file(const char* src, const char* dst)
+{
+    return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+/* mtime is in FILETIME units, only good for comparing against itself */
+bool sys_get_file_info(const char* name, uint64_t* mtime, uint64_t* size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    if (!GetFileAttributesExA(name, GetFileExInfoStandard, &attr))
+        return false;
+
+    *mtime = (uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32 | attr.ftLastWriteTime.dwLowDateTime;
+    *size = (uint64_t)attr.nFileSizeHigh << 32 | attr.nFileSizeLow;
+    return true;
+}
+
+/* read-only view of the whole file, NULL if missing or empty */
+void* sys_map_file(const char* name, size_t* size)
+{
+    HANDLE file, mapping;
+    LARGE_INTEGER len;
+    void* data;
+
+    file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (!GetFileSizeEx(file, &len) || len.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    /* the view keeps the mapping alive */
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return NULL;
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *size = (size_t)len.QuadPart;
+    return data;
+}
+
+void sys_unmap_file(void* data, size_t size)
+{
+    UnmapViewOfFile(data);
+}
+
+/* VirtualAlloc hands out whole allocation granules, 64 KB on every Windows */
+void* sys_alloc_pages(size_t size)
+{
+    void* pages = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    if (pages == NULL)
+        sys_fatal_error("Out of memory");
+
+    return pages;
+}
+
+void sys_free_pages(void* ptr)
+{
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+uint64_t sys_get_time_usec()
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
+
+struct sys_thread {
+    HANDLE handle;
+    sys_thread_fn fn;
+    void *arg;
+};
+
+struct sys_mutex {
+    CRITICAL_SECTION cs;
+};
+
+struct sys_semaphore {
+    HANDLE handle;
+};
+
+static DWORD WINAPI sys_thread_entry(LPVOID param)
+{
+    sys_thread_t *thread = param;
+    int res = thread->fn(thread->arg);
+
+    sys_pool_flush_thread();
+    return (DWORD)res;
+}
+
+sys_thread_t* sys_create_thread(sys_thread_fn fn, void *arg)
+{
+    sys_thread_t *thread = sys_malloc(sizeof(sys_thread_t));
+
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, sys_thread_entry, thread, 0, NULL);
+    if (thread->handle == NULL)
+        sys_fatal_error("Failed to create thread");
+
+    return thread;
+}
+
+/* also frees the thread */
+void sys_join_thread(sys_thread_t *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    sys_free(thread);
+}
+
+sys_mutex_t* sys_create_mutex()
+{
+    sys_mutex_t *mutex = sys_malloc(sizeof(sys_mutex_t));
+    InitializeCriticalSection(&mutex->cs);
+    return mutex;
+}
+
+void sys_destroy_mutex(sys_mutex_t *mutex)
+{
+    DeleteCriticalSection(&mutex->cs);
+    sys_free(mutex);
+}
+
+void sys_lock_mutex(sys_mutex_t *mutex)
+{
+    EnterCriticalSection(&mutex->cs);
+}
+
+void sys_unlock_mutex(sys_mutex_t *mutex)
+{
+    LeaveCriticalSection(&mutex->cs);
+}
+
+sys_semaphore_t* sys_create_semaphore(int initial)
+{
+    sys_semaphore_t *sem = sys_malloc(sizeof(sys_semaphore_t));
+    sem->handle = CreateSemaphoreA(NULL, initial, LONG_MAX, NULL);
+    return sem;
+}
+
+void sys_destroy_semaphore(sys_semaphore_t *sem)
+{
+    CloseHandle(sem->handle);
+    sys_free(sem);
+}
+
+void sys_wait_semaphore(sys_semaphore_t *sem)
+{
+    WaitForSingleObject(sem->handle, INFINITE);
+}
+
+void sys_post_semaphore(sys_semaphore_t *sem, int count)
+{
+    ReleaseSemaphore(sem->handle, count, NULL);
+}
+
+
+int main(int argc, char **argv)
+{
+    bench_config_t bench;
+    bool benchmark = bench_parse_args(&bench, argc, argv);
+
     #ifdef RENG_ENABLE_LOG
     fopen_s(&logfile, "log.txt", "w");
     #endif
 
     #ifdef RENG_MEMTRACE
+    InitializeCriticalSection(&memlock);
     fopen_s(&memfile, "memtrace.txt", "w");
     #endif
 
@@ -448,16 +736,26 @@ int main()
     RegisterRawInputDevices(Rid, 1, sizeof(Rid[0]));
     ShowCursor(false);
 
+    sys_pool_init();
     audio_init();
     gfx_init();
-    rw_init();
     game_init();
 
-    ShowWindow(winapi.hwnd, 1);
-    UpdateWindow(winapi.hwnd);
+    /* -dynres <ms>: scale the world to keep its GPU time under ms */
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], "-dynres") == 0) gfx_dynres_enable((float)atof(argv[i + 1]));
+
+    /* the window stays hidden, frames go to an offscreen target */
+    if (benchmark) {
+        bench_run(&bench);
+    }
+    else {
+        ShowWindow(winapi.hwnd, 1);
+        UpdateWindow(winapi.hwnd);
+        sys.running = true;
+    }
 
     int64_t next_game_tick = sys.time = GetTime();
-    sys.running = true;
 
     while (sys.running) {
         POINT mp;
@@ -500,16 +798,25 @@ int main()
     }
 
     game_deinit();
-    rw_deinit();
     gfx_deinit();
     audio_deinit();
+    asset_deinit();
+    sys_arena_destroy(&sys_frame_arena);
 
+    wglMakeCurrent(NULL, NULL);
+    wglDeleteContext(winapi.glcontext);
     CloseHandle(hProcess);
 
     #ifdef RENG_MEMTRACE
     for (int i = 0; i < ALLOCSTACK_SIZE; i++)
         if (recentmem[i].ptr) fprintf(memfile, "M %llu %s %d\n", recentmem[i].ptr, recentmem[i].file, recentmem[i].line);
 
+    /* pool objects are counted per size class, none of them went through sys_malloc */
+    sys_pool_stats_t pools[SYS_POOL_N_CLASSES + 1];
+    sys_pool_get_stats(pools);
+    for (int i = 0; i <= SYS_POOL_N_CLASSES; i++)
+        fprintf(memfile, "P %u %u %llu %llu\n", pools[i].size, pools[i].n_slabs, pools[i].n_allocs, pools[i].n_frees);
+
     fprintf(memfile, "END\n"
            "malloc %llu\n"
            "realloc %llu\n"
@@ -529,6 +836,8 @@ int main()
     fclose(memfile);
     #endif
 
+    sys_pool_deinit();
+
     #ifdef RENG_ENABLE_LOG
     fclose(logfile);
     #endif
@@ -1,18 +1,19 @@
 #include "utils.h"
 
+/* djb2 with a murmur finalizer, hashtable_t takes bits from both ends */
 unsigned int get_hash(const char* string)
 {
-    unsigned int result = 5381;
-    unsigned char* p;
+    uint32_t h = 5381;
 
-    p = (unsigned char*)string;
+    for (const unsigned char* p = (const unsigned char*)string; *p; p++)
+        h = (h << 5) + h + *p;
 
-    while (*p != '\0') {
-        result = (result << 5) + result + *p;
-        ++p;
-    }
-
-    return result;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
 }
 
 hashbucket_t* hashtable_pick_bucket(hashtable_t* table, size_t n)
@@ -25,22 +26,97 @@ hashbucket_t* hashtable_next_bucket(hashtable_t* table, hashbucket_t* bucket)
     return (hashbucket_t*)(((char*)bucket) + table->bucketsize);
 }
 
+/* ******************* *
+ * LIST IMPLEMENTATION *
+ * ******************* */
+
+/*
+ * Nodes come from list->pool when it is set, else from UTILS_MALLOC. A pool
+ * hands out fixed size nodes from slabs of nodes_per_slab and keeps freed
+ * ones on a free list, slabs go back only in listpool_destroy.
+ */
+
+typedef struct listslab {
+    struct listslab* next;
+} listslab_t;
+
+static listnode_t* list_alloc_node(list_t* list, size_t node_size)
+{
+    listpool_t* pool = list->pool;
+    listnode_t* n;
+
+    if (pool == NULL)
+        return UTILS_MALLOC(node_size);
+
+    if (pool->free == NULL) {
+        listslab_t* slab = UTILS_MALLOC(sizeof(listslab_t) + pool->node_size * pool->nodes_per_slab);
+        char* nodes = (char*)(slab + 1);
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        for (size_t i = pool->nodes_per_slab; i-- > 0;) {
+            n = (listnode_t*)(nodes + i * pool->node_size);
+            n->next = pool->free;
+            pool->free = n;
+        }
+    }
+
+    n = pool->free;
+    pool->free = n->next;
+    return n;
+}
+
+static void list_free_node(list_t* list, listnode_t* n)
+{
+    if (list->pool == NULL) {
+        UTILS_FREE(n);
+        return;
+    }
+
+    n->next = list->pool->free;
+    list->pool->free = n;
+}
+
 void list_destroy(list_t* list)
 {
-    listnode_t* prev = NULL;
     listnode_t* cur = list->begin;
 
     while (cur) {
-        prev = cur;
-        cur = cur->next;
-
-        UTILS_FREE(prev);
+        listnode_t* next = cur->next;
+        list_free_node(list, cur);
+        cur = next;
     }
 
     list->begin = list->end = NULL;
+    list->size = 0;
 }
 
-void list_destroy_node(list_t* list, listnode_t* n)
+void list_link_front(list_t* list, listnode_t* n)
+{
+    n->prev = NULL;
+    n->next = list->begin;
+
+    if (list->begin) list->begin->prev = n;
+    else list->end = n;
+
+    list->begin = n;
+    list->size++;
+}
+
+void list_link_back(list_t* list, listnode_t* n)
+{
+    n->next = NULL;
+    n->prev = list->end;
+
+    if (list->end) list->end->next = n;
+    else list->begin = n;
+
+    list->end = n;
+    list->size++;
+}
+
+void list_unlink(list_t* list, listnode_t* n)
 {
     if (n->prev) n->prev->next = n->next;
     if (n->next) n->next->prev = n->prev;
@@ -48,60 +124,45 @@ void list_destroy_node(list_t* list, listnode_t* n)
     if (list->begin == n) list->begin = n->next;
     if (list->end == n) list->end = n->prev;
 
+    n->prev = n->next = NULL;
     list->size--;
-    UTILS_FREE(n);
 }
 
-void* list_emplace_front_vptr(list_t* list, size_t node_size)
+void list_destroy_node(list_t* list, listnode_t* n)
 {
-    listnode_t* n = UTILS_MALLOC(node_size);
-    list->size++;
+    list_unlink(list, n);
+    list_free_node(list, n);
+}
 
-    if (list->begin == NULL) {
-        list->begin = list->end = n;
-        n->next = n->prev = NULL;
-    }
-    else if (list->begin == list->end) {
-        list->begin = n;
-        list->begin->prev = NULL;
-        list->begin->next = list->end;
-        list->end->prev = list->begin;
-        list->end->next = NULL;
-    }
-    else {
-        n->prev = NULL;
-        n->next = list->begin;
-        list->begin->prev = n;
-        list->begin = n;
-    }
+void* list_emplace_front_vptr(list_t* list, size_t node_size)
+{
+    listnode_t* n = list_alloc_node(list, node_size);
 
+    list_link_front(list, n);
     return LISTNODE_DATAPTR(n, void);
 }
 
 void* list_emplace_back_vptr(list_t* list, size_t node_size)
 {
-    listnode_t* n = UTILS_MALLOC(node_size);
-    list->size++;
+    listnode_t* n = list_alloc_node(list, node_size);
 
-    if (!list->begin) {
-        list->begin = list->end = n;
-        n->next = n->prev = NULL;
-    }
-    else if (list->begin == list->end) {
-        list->end = n;
-        list->begin->prev = NULL;
-        list->begin->next = list->end;
-        list->end->prev = list->begin;
-        list->end->next = NULL;
-    }
-    else {
-        n->next = NULL;
-        n->prev = list->end;
-        list->end->next = n;
-        list->end = n;
+    list_link_back(list, n);
+    return LISTNODE_DATAPTR(n, void);
+}
+
+/* every list using the pool must be destroyed or forgotten first */
+void listpool_destroy(listpool_t* pool)
+{
+    listslab_t* slab = pool->slabs;
+
+    while (slab) {
+        listslab_t* next = slab->next;
+        UTILS_FREE(slab);
+        slab = next;
     }
 
-    return LISTNODE_DATAPTR(n, void);
+    pool->slabs = NULL;
+    pool->free = NULL;
 }
 
 
@@ -109,97 +170,259 @@ void* list_emplace_back_vptr(list_t* list, size_t node_size)
  * HASH TABLE IMPLEMENTATION *
  * ************************* */
 
-hashbucket_t* hashtable_emplace_noname(hashtable_t* table, const char* name)
-{
-    int ind;
-    hashbucket_t* bucket;
+/*
+ * Open addressing over a power of two of buckets. Every bucket has a
+ * control byte: HT_EMPTY, HT_DELETED or the low 7 bits of its hash, and
+ * lookups compare HT_GROUP_LEN control bytes at once, so strcmp only runs
+ * on buckets whose hash matched. The first HT_GROUP_LEN control bytes are
+ * mirrored past the end so a group never wraps. Names live in chunks owned
+ * by the table, a rehash copies the live ones and drops the rest. Erased
+ * buckets are tombstones, emplace rehashes when they or erased names pile up.
+ */
 
-repeat:
-    if (!table->n_buckets) hashtable_grow(table);
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HT_SSE2
+#endif
 
-    ind = get_hash(name) % table->n_buckets;
-    bucket = hashtable_pick_bucket(table, ind * HT_SECTION_LEN);
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
-    for (int i = 0; i < HT_SECTION_LEN; i++) {
-        if (!bucket->used) {
-            bucket->used = 1;
-            return bucket;
-        }
-        bucket = hashtable_next_bucket(table, bucket);
-    }
+#define HT_EMPTY        0x80
+#define HT_DELETED      0xFE
+#define HT_KEYS_CHUNK   4096
+
+typedef struct hashkeys {
+    struct hashkeys* prev;
+    size_t used;
+    size_t capacity;
+} hashkeys_t;
 
-    hashtable_grow(table);
-    goto repeat;
+static inline uint32_t hashtable_ctz(uint32_t m)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return i;
+#else
+    return __builtin_ctz(m);
+#endif
 }
 
-hashbucket_t* hashtable_emplace(hashtable_t* table, const char* name)
+/* bit i is set if byte i of the group equals c */
+static inline uint32_t hashtable_match(const uint8_t* group, uint8_t c)
 {
-    hashbucket_t* b = hashtable_emplace_noname(table, name);
-    size_t len = strlen(name) + 1;
+#ifdef HT_SSE2
+    __m128i g = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < HT_GROUP_LEN; i++)
+        m |= (uint32_t)(group[i] == c) << i;
+    return m;
+#endif
+}
 
-    b->name = UTILS_MALLOC(len);
-    memcpy(b->name, name, len);
+/* empty and deleted buckets, the only control bytes with the top bit set */
+static inline uint32_t hashtable_match_free(const uint8_t* group)
+{
+#ifdef HT_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < HT_GROUP_LEN; i++)
+        m |= (uint32_t)(group[i] >> 7) << i;
+    return m;
+#endif
+}
 
-    return b;
+static void hashtable_set_ctrl(hashtable_t* table, size_t i, uint8_t c)
+{
+    table->ctrl[i] = c;
+    if (i < HT_GROUP_LEN)
+        table->ctrl[table->n_buckets + i] = c;
 }
 
-void hashtable_grow(hashtable_t* table)
+static char* hashtable_store_name(hashtable_t* table, const char* name)
 {
-    int old_n_buckets = table->n_buckets;
-    hashbucket_t* old_ht = table->data;
-    hashbucket_t* item;
+    size_t len = strlen(name) + 1;
+    hashkeys_t* k = table->keys;
+    char* s;
+
+    if (k == NULL || k->used + len > k->capacity) {
+        size_t capacity = len > HT_KEYS_CHUNK ? len : HT_KEYS_CHUNK;
 
-    table->n_buckets = table->n_buckets ? (table->n_buckets * 3) / 2 : 2;
-    table->data = UTILS_MALLOC(table->bucketsize * HT_SECTION_LEN * table->n_buckets);
-    memset(table->data, 0, table->bucketsize * HT_SECTION_LEN * table->n_buckets);
+        k = UTILS_MALLOC(sizeof(hashkeys_t) + capacity);
+        k->prev = table->keys;
+        k->used = 0;
+        k->capacity = capacity;
+        table->keys = k;
+    }
 
-    item = old_ht;
-    for (int i = 0; i < old_n_buckets * HT_SECTION_LEN; i++) {
-        if (item->used)
-            memcpy(hashtable_emplace_noname(table, item->name), item, table->bucketsize);
+    s = (char*)(k + 1) + k->used;
+    memcpy(s, name, len);
+    k->used += len;
+    table->name_bytes += len;
+    return s;
+}
 
-        item = hashtable_next_bucket(table, item);
+static void hashtable_free_names(hashkeys_t* k)
+{
+    while (k != NULL) {
+        hashkeys_t* prev = k->prev;
+        UTILS_FREE(k);
+        k = prev;
     }
+}
+
+/* first empty or deleted bucket on the probe sequence of hash */
+static size_t hashtable_probe_free(hashtable_t* table, uint32_t hash)
+{
+    size_t mask = table->n_buckets - 1;
+    size_t pos = (hash >> 7) & mask;
+    uint32_t m;
 
-    UTILS_FREE(old_ht);
+    while ((m = hashtable_match_free(table->ctrl + pos)) == 0)
+        pos = (pos + HT_GROUP_LEN) & mask;
+
+    return (pos + hashtable_ctz(m)) & mask;
 }
 
-void hashbucket_empty(hashbucket_t* bucket)
+static void hashtable_rehash(hashtable_t* table, size_t n_buckets)
 {
-    UTILS_FREE(bucket->name);
-    bucket->name = NULL;
-    bucket->used = 0;
+    size_t old_n_buckets = table->n_buckets;
+    char* old_data = table->data;
+    uint8_t* old_ctrl = table->ctrl;
+    hashkeys_t* old_keys = table->keys;
+
+    table->n_buckets = n_buckets;
+    table->n_used = 0;
+    table->n_deleted = 0;
+    table->keys = NULL;
+    table->name_bytes = 0;
+    table->name_garbage = 0;
+    table->data = UTILS_MALLOC(table->bucketsize * n_buckets);
+    table->ctrl = UTILS_MALLOC(n_buckets + HT_GROUP_LEN);
+    memset(table->data, 0, table->bucketsize * n_buckets);
+    memset(table->ctrl, HT_EMPTY, n_buckets + HT_GROUP_LEN);
+
+    for (size_t i = 0; i < old_n_buckets; i++) {
+        hashbucket_t* old = (hashbucket_t*)(old_data + i * table->bucketsize);
+        size_t j;
+        hashbucket_t* b;
+
+        if (!old->used)
+            continue;
+
+        j = hashtable_probe_free(table, old->hash);
+        b = hashtable_pick_bucket(table, j);
+        memcpy(b, old, table->bucketsize);
+        b->name = hashtable_store_name(table, old->name);
+        hashtable_set_ctrl(table, j, old->hash & 0x7F);
+        table->n_used++;
+    }
+
+    UTILS_FREE(old_data);
+    UTILS_FREE(old_ctrl);
+    hashtable_free_names(old_keys);
 }
 
-hashbucket_t* hashtable_find(hashtable_t* table, const char* name)
+static hashbucket_t* hashtable_lookup(hashtable_t* table, const char* name, uint32_t hash)
 {
-    size_t ind;
-    hashbucket_t* bucket;
-    
+    size_t mask = table->n_buckets - 1;
+    size_t pos = (hash >> 7) & mask;
+
     if (!table->n_buckets) return NULL;
 
-    ind = get_hash(name) % table->n_buckets;
-    bucket = hashtable_pick_bucket(table, ind * HT_SECTION_LEN);
+    for (;;) {
+        const uint8_t* group = table->ctrl + pos;
 
-    for (int32_t i = 0; i < HT_SECTION_LEN; i++) {
-        if (bucket->name && bucket->used && !strcmp(bucket->name, name)) {
-            return bucket;
+        for (uint32_t m = hashtable_match(group, hash & 0x7F); m; m &= m - 1) {
+            hashbucket_t* b = hashtable_pick_bucket(table, (pos + hashtable_ctz(m)) & mask);
+            if (b->hash == hash && !strcmp(b->name, name))
+                return b;
         }
-        bucket = hashtable_next_bucket(table, bucket);
+
+        /* an empty bucket ends every probe sequence that could reach further */
+        if (hashtable_match(group, HT_EMPTY))
+            return NULL;
+
+        pos = (pos + HT_GROUP_LEN) & mask;
     }
+}
 
-    return NULL;
+hashbucket_t* hashtable_find(hashtable_t* table, const char* name)
+{
+    return hashtable_lookup(table, name, get_hash(name));
 }
 
-void hashtable_destroy(hashtable_t* table)
+/* the bucket of name, a new zeroed one if it wasn't there */
+hashbucket_t* hashtable_emplace(hashtable_t* table, const char* name)
+{
+    uint32_t hash = get_hash(name);
+    hashbucket_t* b = hashtable_lookup(table, name, hash);
+    size_t i;
+
+    if (b != NULL)
+        return b;
+
+    /*
+     * 7/8 full counting tombstones: grow if live buckets are the problem,
+     * else just clean up. Erase and emplace tend to reuse the same tombstone,
+     * so erased names are cleaned up the same way once they outweigh the rest.
+     */
+    if ((table->n_used + table->n_deleted + 1) * 8 > table->n_buckets * 7) {
+        size_t n = table->n_buckets ? table->n_buckets : HT_GROUP_LEN;
+        if ((table->n_used + 1) * 16 > n * 7) n *= 2;
+        hashtable_rehash(table, n);
+    }
+    else if (table->name_garbage > HT_KEYS_CHUNK && table->name_garbage * 2 > table->name_bytes) {
+        hashtable_rehash(table, table->n_buckets);
+    }
+
+    i = hashtable_probe_free(table, hash);
+    if (table->ctrl[i] == HT_DELETED)
+        table->n_deleted--;
+
+    hashtable_set_ctrl(table, i, hash & 0x7F);
+    table->n_used++;
+
+    b = hashtable_pick_bucket(table, i);
+    memset(b, 0, table->bucketsize);
+    b->name = hashtable_store_name(table, name);
+    b->hash = hash;
+    b->used = 1;
+    return b;
+}
+
+/* the name's bytes are reclaimed by the next rehash */
+void hashtable_erase(hashtable_t* table, hashbucket_t* bucket)
 {
-    for (size_t i = 0; i < table->n_buckets * HT_SECTION_LEN; i++)
-        UTILS_FREE(hashtable_pick_bucket(table, i)->name);
+    size_t i = ((char*)bucket - table->data) / table->bucketsize;
+
+    table->name_garbage += strlen(bucket->name) + 1;
+    bucket->name = NULL;
+    bucket->used = 0;
+    hashtable_set_ctrl(table, i, HT_DELETED);
+    table->n_used--;
+    table->n_deleted++;
+}
 
+void hashtable_destroy(hashtable_t* table)
+{
     UTILS_FREE(table->data);
+    UTILS_FREE(table->ctrl);
+    hashtable_free_names(table->keys);
 
     table->n_buckets = 0;
+    table->n_used = 0;
+    table->n_deleted = 0;
     table->data = NULL;
+    table->ctrl = NULL;
+    table->keys = NULL;
+    table->name_bytes = 0;
+    table->name_garbage = 0;
 }
 
 /* ********************* *
@@ -273,37 +496,83 @@ void vector_destroy(vector_t* vec)
  * STR8 IMPLEMENTATION *
  * ******************* */
 
+/* the only place data is (re)allocated, moves off caller storage on the first call */
+static void str8_set_capacity(str8 *s, size_t capacity)
+{
+    if (s->data && s->data == s->fixed) {
+        size_t keep = s->size < capacity ? s->size : capacity;
+        char *data = UTILS_MALLOC(capacity + 1);
+
+        memcpy(data, s->data, keep);
+        data[keep] = '\0';
+        s->data = data;
+    }
+    else {
+        s->data = UTILS_REALLOC(s->data, capacity + 1);
+    }
+
+    s->capacity = capacity;
+}
+
+/* doubles, so appending a char at a time is amortized O(1) */
+static void str8_grow(str8 *s, size_t size)
+{
+    if (size <= s->capacity && s->data)
+        return;
+
+    str8_set_capacity(s, size > s->capacity * 2 ? size : s->capacity * 2);
+}
+
 void str8_create(str8 *s, size_t size)
 {
     s->size = s->capacity = size;
     s->data = UTILS_MALLOC(size + 1);
     s->data[size] = '\0';
+    s->fixed = NULL;
+}
+
+/* buf must outlive s, bufsize includes the terminator */
+void str8_create_on_buffer(str8 *s, char *buf, size_t bufsize)
+{
+    s->size = 0;
+    s->capacity = bufsize - 1;
+    s->data = s->fixed = buf;
+    s->data[0] = '\0';
 }
 
 void str8_resize(str8 *s, size_t newsize)
 {
-    s->data = UTILS_REALLOC(s->data, newsize + 1);
+    str8_set_capacity(s, newsize);
     if (newsize > s->size)
         memset(s->data + s->size, 0, newsize - s->size + 1);
-    s->size = s->capacity = newsize;
+    s->size = newsize;
+    s->data[newsize] = '\0';
 }
 
 void str8_resize_ub(str8 *s, size_t newsize)
 {
-    s->data = UTILS_REALLOC(s->data, newsize + 1);
+    str8_set_capacity(s, newsize);
     s->data[newsize] = '\0';
-    s->size = s->capacity = newsize;
+    s->size = newsize;
+}
+
+void str8_reserve(str8 *s, size_t capacity)
+{
+    if (capacity > s->capacity || !s->data)
+        str8_set_capacity(s, capacity);
 }
 
 void str8_make_sure_fits(str8 *s, size_t ind)
 {
-    if (ind < s->capacity) return;
+    size_t capacity = s->capacity;
+
+    if (ind < capacity) return;
     
     do {
-        s->capacity = (s->capacity ? ((s->capacity * 3) / 2) : 2);
-    } while (ind >= s->capacity);
+        capacity = (capacity ? ((capacity * 3) / 2) : 2);
+    } while (ind >= capacity);
 
-    s->data = (char *)UTILS_REALLOC(s->data, s->capacity + 1);
+    str8_set_capacity(s, capacity);
 }
 
 void str8_push_back(str8 *s, char c)
@@ -313,11 +582,125 @@ void str8_push_back(str8 *s, char c)
     s->data[s->size] = '\0';
 }
 
+void str8_clear(str8 *s)
+{
+    s->size = 0;
+    if (s->data)
+        s->data[0] = '\0';
+}
+
+void str8_append_n(str8 *s, const char *src, size_t n)
+{
+    str8_grow(s, s->size + n);
+    memcpy(s->data + s->size, src, n);
+    s->size += n;
+    s->data[s->size] = '\0';
+}
+
+void str8_append(str8 *s, const char *cstr)
+{
+    str8_append_n(s, cstr, strlen(cstr));
+}
+
+/* formats straight into the spare capacity, a second pass only when that was too short */
+void str8_append_vfmt(str8 *s, const char *fmt, va_list args)
+{
+    size_t avail = s->data ? s->capacity - s->size + 1 : 0;
+    va_list first;
+    int len;
+
+    va_copy(first, args);
+    len = vsnprintf(s->data ? s->data + s->size : NULL, avail, fmt, first);
+    va_end(first);
+
+    if (len < 0) {
+        if (s->data)
+            s->data[s->size] = '\0';
+        return;
+    }
+
+    if ((size_t)len >= avail) {
+        str8_grow(s, s->size + len);
+        vsnprintf(s->data + s->size, len + 1, fmt, args);
+    }
+
+    s->size += len;
+}
+
+void str8_append_fmt(str8 *s, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    str8_append_vfmt(s, fmt, args);
+    va_end(args);
+}
+
+void str8_append_uint(str8 *s, uint64_t v)
+{
+    char digits[20];
+    size_t n = sizeof(digits);
+
+    do {
+        digits[--n] = '0' + (char)(v % 10);
+        v /= 10;
+    } while (v);
+
+    str8_append_n(s, digits + n, sizeof(digits) - n);
+}
+
+void str8_append_int(str8 *s, int64_t v)
+{
+    if (v < 0) {
+        str8_append_n(s, "-", 1);
+        str8_append_uint(s, 0 - (uint64_t)v);
+    }
+    else {
+        str8_append_uint(s, (uint64_t)v);
+    }
+}
+
+/* %.*f for up to 9 decimals but rounds halves up, huge values and nan/inf go through printf */
+void str8_append_float(str8 *s, double v, int decimals)
+{
+    static const uint64_t pow10[10] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+    };
+    uint64_t scaled;
+    char frac[9];
+
+    decimals = decimals < 0 ? 0 : (decimals > 9 ? 9 : decimals);
+
+    if (!(v > -1e9 && v < 1e9)) {
+        str8_append_fmt(s, "%.*f", decimals, v);
+        return;
+    }
+
+    if (v < 0) {
+        str8_append_n(s, "-", 1);
+        v = -v;
+    }
+
+    scaled = (uint64_t)(v * pow10[decimals] + 0.5);
+    str8_append_uint(s, scaled / pow10[decimals]);
+
+    if (decimals) {
+        scaled %= pow10[decimals];
+        for (int i = decimals - 1; i >= 0; i--) {
+            frac[i] = '0' + (char)(scaled % 10);
+            scaled /= 10;
+        }
+
+        str8_append_n(s, ".", 1);
+        str8_append_n(s, frac, decimals);
+    }
+}
+
 void str8_destroy(str8 *s)
 {
-    UTILS_FREE(s->data);
+    if (s->data != s->fixed)
+        UTILS_FREE(s->data);
     s->size = s->capacity = 0;
-    s->data = NULL;
+    s->data = s->fixed = NULL;
 }
 
 char *str8_duplicate_as_cstr(str8 *s)
@@ -334,16 +717,16 @@ void str8_create_from_cstr(str8 *s, const char *cstr)
     size_t len = strlen(cstr);
     s->size = s->capacity = len;
     s->data = UTILS_MALLOC(len + 1);
+    s->fixed = NULL;
     memcpy(s->data, cstr, len + 1);
 }
 
 void str8_create_by_vprintf(str8 *s, const char *fmt, va_list args)
 {
-    size_t len = vsnprintf(NULL, 0, fmt, args);
-
-    s->data = UTILS_MALLOC(len + 1);
-    s->size = s->capacity = len;
-    vsnprintf(s->data, len + 1, fmt, args);
+    *s = (str8)EMPTY_STR;
+    str8_append_vfmt(s, fmt, args);
+    if (!s->data)
+        str8_set_capacity(s, 0);
 }
 
 void str8_create_by_printf(str8 *s, const char *fmt, ...)
@@ -357,7 +740,7 @@ void str8_create_by_printf(str8 *s, const char *fmt, ...)
 void str8_fit(str8 *s)
 {
     s->size = s->capacity;
-    s->data = UTILS_REALLOC(s->data, s->capacity + 1);
+    str8_set_capacity(s, s->capacity);
 }
 
 
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef UTILS_MALLOC
 #include <stdlib.h>
@@ -26,19 +27,22 @@ typedef struct utils_vec2 {
 
 #define LISTNODE_DATA(nodeptr, type) (*((type *)(nodeptr + 1)))
 #define LISTNODE_DATAPTR(nodeptr, type) ((type *)(nodeptr + 1))
+#define LISTNODE_OF(dataptr) ((listnode_t*)(dataptr) - 1)
+#define LISTNODE_CONTAINER(nodeptr, type, member) ((type*)((char*)(nodeptr) - offsetof(type, member)))
+#define listpool_of(type, per_slab) ((listpool_t) { .node_size = (sizeof(listnode_t) + sizeof(type) + 7) & ~(size_t)7, .nodes_per_slab = (per_slab) })
 #define list_emplace_front(list_ptr, type) ((type*)list_emplace_front_vptr((list_ptr), sizeof(listnode_t) + sizeof(type)))
 #define list_emplace_back(list_ptr, type) ((type*)list_emplace_back_vptr((list_ptr), sizeof(listnode_t) + sizeof(type)))
 
-#define HT_SECTION_LEN 4
+#define HT_GROUP_LEN 16
 #define HASHBUCKET_DATA(bucket_ptr, type) (*((type*)(bucket_ptr + 1)))
 #define HASHBUCKET_DATAPTR(bucket_ptr, type) ((type*)(bucket_ptr + 1))
-#define hashtable_of(type) ((hashtable_t) { .n_buckets = 0, .bucketsize = sizeof(hashbucket_t) + sizeof(type), .data = NULL })
+#define hashtable_of(type) ((hashtable_t) { .n_buckets = 0, .bucketsize = (sizeof(hashbucket_t) + sizeof(type) + 7) & ~(size_t)7, .data = NULL })
 
 #define vector_of(type) ((vector_t) { .size = 0, .capacity = 0, .typesize = sizeof(type), .data = NULL })
 #define vector_at(vec_ptr, n, type) ((type*)vector_at_vptr(vec_ptr, n))
 #define vector_emplace_back(vec_ptr, type) ((type*)vector_emplace_back_vptr(vec_ptr))
 
-#define EMPTY_STR { .size = 0, .capacity = 0, .data = NULL }
+#define EMPTY_STR { .size = 0, .capacity = 0, .data = NULL, .fixed = NULL }
 
 #define EMPTY_QUADTREE(left_, top_, right_, bottom_, parent_) \
     ((quadtree_t) {                     \
@@ -58,21 +62,42 @@ typedef struct listnode
     struct listnode* next;
 } listnode_t;
 
+typedef struct listpool {
+    size_t node_size;           /* listnode_t and the largest payload */
+    size_t nodes_per_slab;
+    listnode_t* free;
+    struct listslab* slabs;
+} listpool_t;
+
+/*
+ * Three ways to own nodes: list_emplace_* mallocs each one, the same calls
+ * take them from pool when it is set, and list_link_* / list_unlink only
+ * link nodes embedded in some other struct (intrusive, never destroy those).
+ */
 typedef struct list {
     size_t size;
     listnode_t* begin;
     listnode_t* end;
+    listpool_t* pool;
 } list_t;
 
 typedef struct hashbucket {
-    char *name;
+    char *name;                 /* owned by the table */
+    uint32_t hash;
     int32_t used;
 } hashbucket_t;
 
+/* see utils.c, iterate with hashtable_pick_bucket over n_buckets and skip unused ones */
 typedef struct hashtable {
-    size_t n_buckets;
+    size_t n_buckets;           /* power of two, 0 before the first emplace */
+    size_t n_used;
+    size_t n_deleted;
     size_t bucketsize;
     char *data;
+    uint8_t *ctrl;
+    struct hashkeys *keys;
+    size_t name_bytes;          /* stored in keys, including erased names */
+    size_t name_garbage;        /* of those, erased */
 } hashtable_t;
 
 typedef struct vector {
@@ -84,16 +109,115 @@ typedef struct vector {
 
 typedef void (*vector_data_constructor_t)(void* self);
 
+/*
+ * Typed vector, the element size is a constant and the first n_inline
+ * elements live in the struct itself. capacity stays 0 until it spills to
+ * the heap, so a zeroed one is empty and it can be moved with memcpy or
+ * realloc like vector_t. Pointers from _at go stale on growth.
+ */
+#define VECTOR_DEFINE(name, T, n_inline)                                            \
+    typedef struct name {                                                           \
+        size_t size;                                                                \
+        size_t capacity;        /* of heap, 0 while inline */                       \
+        union {                                                                     \
+            T *heap;                                                                \
+            T small[(n_inline) > 0 ? (n_inline) : 1];                               \
+        } u;                                                                        \
+    } name##_t;                                                                     \
+                                                                                    \
+    static inline T* name##_data(name##_t *v)                                       \
+    {                                                                               \
+        return v->capacity ? v->u.heap : v->u.small;                                \
+    }                                                                               \
+                                                                                    \
+    static inline size_t name##_capacity(const name##_t *v)                         \
+    {                                                                               \
+        return v->capacity ? v->capacity : sizeof(v->u.small) / sizeof(T);          \
+    }                                                                               \
+                                                                                    \
+    static inline T* name##_at(name##_t *v, size_t n)                               \
+    {                                                                               \
+        return name##_data(v) + n;                                                  \
+    }                                                                               \
+                                                                                    \
+    static inline void name##_reserve(name##_t *v, size_t n)                        \
+    {                                                                               \
+        T *heap;                                                                    \
+                                                                                    \
+        if (n <= name##_capacity(v))                                                \
+            return;                                                                 \
+                                                                                    \
+        if (v->capacity) {                                                          \
+            heap = (T*)UTILS_REALLOC(v->u.heap, n * sizeof(T));                     \
+        } else {                                                                    \
+            heap = (T*)UTILS_MALLOC(n * sizeof(T));                                 \
+            memcpy(heap, v->u.small, v->size * sizeof(T));                          \
+        }                                                                           \
+                                                                                    \
+        v->u.heap = heap;                                                           \
+        v->capacity = n;                                                            \
+    }                                                                               \
+                                                                                    \
+    /* uninitialized, doubles the storage when full */                              \
+    static inline T* name##_emplace_back(name##_t *v)                               \
+    {                                                                               \
+        if (v->size == name##_capacity(v))                                          \
+            name##_reserve(v, v->size < 8 ? 8 : v->size * 2);                       \
+                                                                                    \
+        return name##_data(v) + v->size++;                                          \
+    }                                                                               \
+                                                                                    \
+    static inline void name##_append_n(name##_t *v, const T *src, size_t n)         \
+    {                                                                               \
+        if (v->size + n > name##_capacity(v))                                       \
+            name##_reserve(v, v->size + n > v->size * 2 ? v->size + n : v->size * 2); \
+                                                                                    \
+        memcpy(name##_data(v) + v->size, src, n * sizeof(T));                       \
+        v->size += n;                                                               \
+    }                                                                               \
+                                                                                    \
+    /* back to inline storage if the elements fit there */                          \
+    static inline void name##_shrink_to_fit(name##_t *v)                            \
+    {                                                                               \
+        T *heap = v->u.heap;                                                        \
+                                                                                    \
+        if (v->capacity == 0 || v->capacity == v->size)                             \
+            return;                                                                 \
+                                                                                    \
+        if (v->size <= sizeof(v->u.small) / sizeof(T)) {                            \
+            memcpy(v->u.small, heap, v->size * sizeof(T));                          \
+            UTILS_FREE(heap);                                                       \
+            v->capacity = 0;                                                        \
+        } else {                                                                    \
+            v->u.heap = (T*)UTILS_REALLOC(heap, v->size * sizeof(T));               \
+            v->capacity = v->size;                                                  \
+        }                                                                           \
+    }                                                                               \
+                                                                                    \
+    static inline void name##_destroy(name##_t *v)                                  \
+    {                                                                               \
+        if (v->capacity)                                                            \
+            UTILS_FREE(v->u.heap);                                                  \
+                                                                                    \
+        memset(v, 0, sizeof(*v));                                                   \
+    }
+
+/*
+ * data always has capacity + 1 bytes, the string is kept null terminated.
+ * A builder made with str8_create_on_buffer starts in caller storage and
+ * only moves to the heap when it outgrows it, str8_clear keeps whatever
+ * storage it has, so a reused builder stops allocating.
+ */
 typedef struct str8 {
     size_t size;
     size_t capacity;
     char *data;
+    char *fixed;                /* caller storage, never freed */
 } str8;
 
 typedef struct object2d {
     #define EXTEND_OBJECT2D   \
         UTILS_VECTOR3 pos;    \
-        vector_t indices;     \
                               \
         struct {              \
             UTILS_VECTOR2 lt; \
@@ -130,16 +254,18 @@ void            list_destroy(list_t* list);
 void            list_destroy_node(list_t* list, listnode_t* n);
 void*           list_emplace_front_vptr(list_t* list, size_t node_size);
 void*           list_emplace_back_vptr(list_t* list, size_t node_size);
+void            list_link_front(list_t* list, listnode_t* n);
+void            list_link_back(list_t* list, listnode_t* n);
+void            list_unlink(list_t* list, listnode_t* n);
+void            listpool_destroy(listpool_t* pool);
 
 hashbucket_t*   hashtable_pick_bucket(hashtable_t* table, size_t n);
 hashbucket_t*   hashtable_next_bucket(hashtable_t* table, hashbucket_t* bucket);
 hashbucket_t*   hashtable_emplace(hashtable_t* table, const char* name);
 hashbucket_t*   hashtable_find(hashtable_t* table, const char* name);
-void            hashtable_grow(hashtable_t* table);
+void            hashtable_erase(hashtable_t* table, hashbucket_t* bucket);
 void            hashtable_destroy(hashtable_t* table);
 
-void            hashbucket_empty(hashbucket_t* bucket);
-
 void*           vector_at_vptr(vector_t* vec, size_t n);
 void            vector_resize_ub(vector_t* vec, size_t newsize);
 void            vector_resize_memset(vector_t* vec, size_t newsize, int32_t fill);
@@ -153,6 +279,16 @@ void            str8_create(str8 *s, size_t size);
 void            str8_create_from_cstr(str8 *str, const char *cstr);
 void            str8_create_by_printf(str8 *str, const char *fmt, ...);
 void            str8_create_by_vprintf(str8 *str, const char *fmt, va_list args);
+void            str8_create_on_buffer(str8 *s, char *buf, size_t bufsize);
+void            str8_reserve(str8 *s, size_t capacity);
+void            str8_clear(str8 *s);
+void            str8_append(str8 *s, const char *cstr);
+void            str8_append_n(str8 *s, const char *src, size_t n);
+void            str8_append_fmt(str8 *s, const char *fmt, ...);
+void            str8_append_vfmt(str8 *s, const char *fmt, va_list args);
+void            str8_append_int(str8 *s, int64_t v);
+void            str8_append_uint(str8 *s, uint64_t v);
+void            str8_append_float(str8 *s, double v, int decimals);
 void            str8_resize(str8 *s, size_t newsize);
 void            str8_resize_ub(str8 *s, size_t newsize);
 void            str8_push_back(str8 *s, char c);